@@ -33,6 +33,7 @@
 #define PN5180_SEND_DATA                (0x09)
 #define PN5180_READ_DATA                (0x0A)
 #define PN5180_SWITCH_MODE              (0x0B)
+#define PN5180_MFC_AUTHENTICATE         (0x0C)
 #define PN5180_LOAD_RF_CONFIG           (0x11)
 #define PN5180_RF_ON                    (0x16)
 #define PN5180_RF_OFF                   (0x17)
@@ -375,7 +376,7 @@ uint8_t * PN5180::readData(int len) {
   return readBuffer;
 }
 
-bool PN5180::readData(uint8_t len, uint8_t *buffer) {
+bool PN5180::readData(uint16_t len, uint8_t *buffer) {
 	if (len > 508) {
 		return false;
 	}
@@ -386,8 +387,14 @@ bool PN5180::readData(uint8_t len, uint8_t *buffer) {
 	return success;
 }
 
-/* prepare LPCD registers */
-bool PN5180::prepareLPCD() {
+/* prepare LPCD registers
+ * fieldOn:   field on time, fieldOn x 8us + 62us
+ * threshold: AGC deviation from the reference which wakes the PN5180
+ * lpcdMode:  LPCD_MODE_SELF_CALIBRATION or LPCD_MODE_STORED_REFERENCE, the
+ *            reference in LPCD_REFERENCE_VALUE has to be written before
+ * PN5180LPCD chooses these values from measurements.
+ */
+bool PN5180::prepareLPCD(uint8_t fieldOn, uint8_t threshold, uint8_t lpcdMode) {
   //=======================================LPCD CONFIG================================================================================
   PN5180DEBUG(F("----------------------------------"));
   PN5180DEBUG(F("prepare LPCD..."));
@@ -395,29 +402,28 @@ bool PN5180::prepareLPCD() {
   uint8_t data[255];
   uint8_t response[256];
     //1. Set Fieldon time                                           LPCD_FIELD_ON_TIME (0x36)
-  uint8_t fieldOn = 0xF0;//0x## -> ##(base 10) x 8μs + 62 μs
-  data[0] = fieldOn;
-  writeEEprom(0x36, data, 1);
-  readEEprom(0x36, response, 1);
+  data[0] = fieldOn; //0x## -> ##(base 10) x 8μs + 62 μs
+  writeEEprom(LPCD_FIELD_ON_TIME, data, 1);
+  readEEprom(LPCD_FIELD_ON_TIME, response, 1);
   fieldOn = response[0];
   PN5180DEBUG("LPCD-fieldOn time: ");
   PN5180DEBUG(formatHex(fieldOn));
 
     //2. Set threshold level                                         AGC_LPCD_THRESHOLD @ EEPROM 0x37
-  uint8_t threshold = 0x03;
   data[0] = threshold;
-  writeEEprom(0x37, data, 1);
-  readEEprom(0x37, response, 1);
+  writeEEprom(LPCD_THRESHOLD, data, 1);
+  readEEprom(LPCD_THRESHOLD, response, 1);
   threshold = response[0];
   PN5180DEBUG("LPCD-threshold: ");
   PN5180DEBUG(formatHex(threshold));
 
   //3. Select LPCD mode                                               LPCD_REFVAL_GPO_CONTROL (0x38)
-  uint8_t lpcdMode = 0x01; // 1 = LPCD SELF CALIBRATION 
-                           // 0 = LPCD AUTO CALIBRATION (this mode does not work, should look more into it, no reason why it shouldn't work)
+  // 1 = LPCD SELF CALIBRATION 
+  // 0 = LPCD AUTO CALIBRATION, compares against LPCD_REFERENCE_VALUE, which
+  //     has to be measured and written first (see PN5180LPCD::calibrate())
   data[0] = lpcdMode;
-  writeEEprom(0x38, data, 1);
-  readEEprom(0x38, response, 1);
+  writeEEprom(LPCD_REFVAL_GPO_CONTROL, data, 1);
+  readEEprom(LPCD_REFVAL_GPO_CONTROL, response, 1);
   lpcdMode = response[0];
   PN5180DEBUG("lpcdMode: ");
   PN5180DEBUG(formatHex(lpcdMode));
@@ -448,6 +454,7 @@ bool PN5180::prepareLPCD() {
  * max. wake-up time is 2960 ms.
  */
 bool PN5180::switchToLPCD(uint16_t wakeupCounterInMs) {
+  rfOffCount++; // the field is only pulsed for the LPCD measurements
   // clear all IRQ flags
   clearIRQStatus(0xffffffff); 
   // enable only LPCD and general error IRQ
@@ -460,6 +467,39 @@ bool PN5180::switchToLPCD(uint16_t wakeupCounterInMs) {
   return success;
 }
 
+/*
+ * MFC_AUTHENTICATE - 0x0C
+ * This command is used to perform a MIFARE Classic Authentication on an activated card.
+ * It takes the key, card UID and the key type to authenticate at given block address. The
+ * response contains 1 byte indicating the authentication status:
+ *   0x00 = authentication successful, MFC_CRYPTO_ON is set in SYSTEM_CONFIG
+ *   0x01 = authentication failed (permission denied)
+ *   0x02 = timeout, no answer from the card
+ * keyType: 0x60 for key A, 0x61 for key B
+ * uid: the 4 byte UID used for authentication
+ * Returns 0xFF if the command could not be sent.
+ */
+uint8_t PN5180::mfcAuthenticate(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t *uid) {
+  PN5180DEBUG(F("MFC Authenticate block "));
+  PN5180DEBUG(blockNo);
+  PN5180DEBUG("\n");
+
+  uint8_t cmd[13];
+  uint8_t status = 0xFF;
+  cmd[0] = PN5180_MFC_AUTHENTICATE;
+  for (int i=0; i<6; i++) cmd[1+i] = key[i];
+  cmd[7] = keyType;
+  cmd[8] = blockNo;
+  for (int i=0; i<4; i++) cmd[9+i] = uid[i];
+
+  PN5180_SPI.beginTransaction(SPI_SETTINGS);
+  bool success = transceiveCommand(cmd, sizeof(cmd), &status, 1);
+  PN5180_SPI.endTransaction();
+
+  if (!success) return 0xFF;
+  return status;
+}
+
 /*
  * LOAD_RF_CONFIG - 0x11
  * Parameter 'Transmitter Configuration' must be in the range from 0x0 - 0x1C, inclusive. If
@@ -535,6 +575,7 @@ bool PN5180::setRF_off() {
   PN5180DEBUG(F("Set RF OFF\n"));
 
   uint8_t cmd[2] { PN5180_RF_OFF, 0x00 };
+  rfOffCount++;
 
   PN5180_SPI.beginTransaction(SPI_SETTINGS);
   bool success = transceiveCommand(cmd, 2);
@@ -701,7 +742,7 @@ for(int i = 0; i < sendBufferLen; i++){
 
 #ifdef DEBUG
   PN5180DEBUG(F("Received: "));
-  for (uint8_t i=0; i<recvBufferLen; i++) {
+  for (size_t i=0; i<recvBufferLen; i++) {
     if (i > 0) PN5180DEBUG(" ");
     PN5180DEBUG(formatHex(recvBuffer[i]));
   }
@@ -715,6 +756,7 @@ for(int i = 0; i < sendBufferLen; i++){
  * Reset NFC device
  */
 void PN5180::reset() {
+  rfOffCount++; // the reset switches the RF field off
   uint32_t resetWhileLoopTimeout= millis();
   while(digitalRead_alt(PN5180_BUSY)){
     Serial.println("resetting");
@@ -771,6 +813,24 @@ bool PN5180::clearIRQStatus(uint32_t irqMask) {
   return writeRegister(IRQ_CLEAR, irqMask);
 }
 
+/*
+ * Poll IRQ_STATUS until at least one of the bits in irqMask is set, or
+ * timeoutUs has elapsed. Returns the last IRQ status read; on timeout
+ * none of the bits in irqMask are set.
+ */
+uint32_t PN5180::waitForIRQ(uint32_t irqMask, uint32_t timeoutUs) {
+  unsigned long startedWaiting = micros();
+  uint32_t irqStatus = getIRQStatus();
+  while (0 == (irqStatus & irqMask)) {
+    if (micros() - startedWaiting > timeoutUs) {
+      PN5180DEBUG(F("waitForIRQ timeout\n"));
+      break;
+    }
+    irqStatus = getIRQStatus();
+  }
+  return irqStatus;
+}
+
 /*
  * Get TRANSCEIVE_STATE from RF_STATUS register
  */
@@ -41,6 +41,7 @@
 #define SYSTEM_STATUS       (0x24)
 #define TEMP_CONTROL        (0x25)
 #define AGC_REF_CONFIG		  (0x26)
+#define AGC_VALUE_MASK      (0x000003ff) // current AGC value in AGC_REF_CONFIG
 
 
 // PN5180 EEPROM Addresses
@@ -49,6 +50,14 @@
 #define FIRMWARE_VERSION    (0x12)
 #define EEPROM_VERSION      (0x14)
 #define IRQ_PIN_CONFIG      (0x1A)
+#define LPCD_REFERENCE_VALUE    (0x34)
+#define LPCD_FIELD_ON_TIME      (0x36)
+#define LPCD_THRESHOLD          (0x37)
+#define LPCD_REFVAL_GPO_CONTROL (0x38)
+
+// LPCD_REFVAL_GPO_CONTROL modes
+#define LPCD_MODE_STORED_REFERENCE (0x00) // reference from LPCD_REFERENCE_VALUE
+#define LPCD_MODE_SELF_CALIBRATION (0x01) // reference measured when entering LPCD
 
 enum PN5180TransceiveStat {
   PN5180_TS_Idle = 0,
@@ -73,6 +82,21 @@ enum PN5180TransceiveStat {
 #define GENERAL_ERROR_IRQ_STAT 	(1<<17) // General error IRQ
 #define LPCD_IRQ_STAT 			(1<<19) // LPCD Detection IRQ
 
+// PN5180 RX_STATUS
+#define RX_BYTES_RECEIVED_MASK  	(0x000001ff) // Number of bytes received
+#define RX_DATA_INTEGRITY_ERROR 	(1<<16) // Data integrity (CRC/parity) error
+#define RX_PROTOCOL_ERROR       	(1<<17) // Protocol error
+#define RX_COLLISION_DETECTED   	(1<<18) // Collision detected
+#define RX_COLL_POS_SHIFT       	(19)    // Bit position of the first collision
+#define RX_COLL_POS_MASK        	(0x7f)
+
+// PN5180 CRC_RX_CONFIG
+#define RX_BIT_ALIGN_SHIFT      	(6)     // Bit position of the first received bit
+#define RX_BIT_ALIGN_MASK       	(0x000001c0)
+
+// PN5180 RF reception buffer
+#define PN5180_RX_BUFFER_SIZE   	(508)
+
 class PN5180 {
 private:
   uint8_t PN5180_NSS;   // active low
@@ -83,8 +107,9 @@ private:
   bool I2C_Mode = false;
 
   SPISettings SPI_SETTINGS;
-  uint8_t readBuffer[508];
+  uint8_t readBuffer[PN5180_RX_BUFFER_SIZE];
   static uint16_t ID_Incrementor;
+  uint16_t rfOffCount = 0;
 
 public:
   PN5180(uint8_t SSpin, uint8_t BUSYpin, uint8_t RSTpin, SPIClass& spi=SPI);
@@ -119,11 +144,13 @@ public:
   bool sendData(uint8_t *data, int len, uint8_t validBits = 0);
   /* cmd 0x0a */
   uint8_t * readData(int len);
-  bool readData(uint8_t len, uint8_t *buffer);
+  bool readData(uint16_t len, uint8_t *buffer);
   /* prepare LPCD registers */
-  bool prepareLPCD();
+  bool prepareLPCD(uint8_t fieldOn = 0xF0, uint8_t threshold = 0x03, uint8_t lpcdMode = LPCD_MODE_SELF_CALIBRATION);
   /* cmd 0x0B */
   bool switchToLPCD(uint16_t wakeupCounterInMs);
+  /* cmd 0x0C */
+  uint8_t mfcAuthenticate(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t *uid);
   /* cmd 0x11 */
   bool loadRFConfig(uint8_t txConf, uint8_t rxConf);
 
@@ -131,6 +158,8 @@ public:
   bool setRF_on();
   /* cmd 0x17 */
   bool setRF_off();
+  // changes whenever the RF field was switched off, tags lost their state
+  uint16_t getRFOffCount() { return rfOffCount; }
   bool digitalRead_alt(uint8_t pin);
   void digitalWrite_alt(uint8_t pin, bool state);
 
@@ -143,6 +172,7 @@ public:
   uint8_t commandTimeout = 25;
   uint32_t getIRQStatus();
   bool clearIRQStatus(uint32_t irqMask);
+  uint32_t waitForIRQ(uint32_t irqMask, uint32_t timeoutUs);
 
   PN5180TransceiveStat getTransceiveState();
   void showIRQStatus(uint32_t irqStatus);
@@ -24,6 +24,22 @@
 #include "Debug.h"
 #include "LibPrintf.h"
 
+// max. time to wait for the answer of a short frame (ATQA, UID CLn, SAK)
+#define ISO14443_RX_TIMEOUT_US (1000)
+// max. time to wait for 16 bytes of data, ACK/NAK and the end of programming
+#define MIFARE_READ_TIMEOUT_US (5000)
+#define MIFARE_ACK_TIMEOUT_US  (2000)
+#define MIFARE_WRITE_TIMEOUT_US (15000)
+#define MIFARE_ACK (0x0A)
+// air time of one byte incl. parity at 106 kbit/s
+#define ISO14443_BYTE_TIME_US (86)
+// FAST_READ pages per exchange, 504 bytes + CRC fit into the 508 byte RX buffer
+#define NTAG_FAST_READ_MAX_PAGES (126)
+// ISO14443-4 frame size of the reader, FSDI=8 (256 bytes)
+#define ISO14443_FSDI (8)
+#define ISO14443_ACTIVATION_FWT_US (5000)
+// retransmissions of a block after a timeout or a transmission error
+#define ISO14443_4_MAX_RETRIES (2)
 
 
 PN5180ISO14443::PN5180ISO14443(uint8_t SSpin, uint8_t BUSYpin, uint8_t RSTpin, SPIClass& spi) 
@@ -44,15 +60,39 @@ bool PN5180ISO14443::errored(){
 
 ISO14443_UPDATE_STATE PN5180ISO14443::update(){
 	ISO14443_UPDATE_STATE newState = ISO14443_NOT_UPDATED;
-	uint8_t prevTagData[7];
-	for(int i = 0; i < 7; i++){
+	if (presenceCheck && cardHalted) {
+		// same card still in the field, no need for a full activation
+		if (checkPresence()) return newState;
+		cardHalted = false;
+	}
+	uint8_t prevTagData[10];
+	for(int i = 0; i < 10; i++){
 		prevTagData[i] = tagData[i];
 	}
 	
 	// setupRF();
 	int uidLength = readCardSerial(tagData);
 	// printf("UID length -- %i\n", uidLength);
-	if(uidLength != 4 && uidLength != 7 && uidLength != -10 && uidLength != 0){
+	switch (lastResult) {
+		case ISO14443_COLLISION:
+		case ISO14443_CRC_ERROR:
+		case ISO14443_PROTOCOL_ERROR:
+			// transient RF fault (two cards, card at the edge of the field),
+			// keep the last known card and retry on the next update()
+			cardHalted = false;
+			setRF_off();
+			return ISO14443_NOT_UPDATED;
+		case ISO14443_SPI_TIMEOUT:
+			printf("reader %i activation failed -- step %i\n", readerID, lastStep);
+			hadError = true;
+			return ISO14443_ERROR;
+		case ISO14443_NO_CARD:
+			uidLength = 0;
+			break;
+		default:
+			break;
+	}
+	if(uidLength != 4 && uidLength != 7 && uidLength != 10 && uidLength != -10 && uidLength != 0){
 		printf("reader %i uid length -- %i\n", readerID, uidLength);
 		newState = ISO14443_ERROR;	
 		hadError = true;
@@ -60,9 +100,20 @@ ISO14443_UPDATE_STATE PN5180ISO14443::update(){
 		// setRF_off();
 		return newState;
 	}
-	setRF_off();
-	if(uidLength != 4 && uidLength != 7){
-		for(int i = 0; i < 7; i++){
+	if (presenceCheck && (uidLength == 4 || uidLength == 7 || uidLength == 10)) {
+		// park the card in HALT and keep the field on, so the next update()
+		// can confirm it with a single WUPA
+		cardHalted = mifareHalt();
+	}
+	else {
+		cardHalted = false;
+		setRF_off();
+	}
+	if(uidLength != 4 && uidLength != 7 && uidLength != 10){
+		// the last card left the field, it may be written elsewhere
+		if (tagCache && (prevTagData[0] != 0))
+		  tagCache->invalidate(prevTagData, lastTagLength);
+		for(int i = 0; i < 10; i++){
 			tagData[i] = 0;
 		}
 		uidLength = 0;
@@ -70,7 +121,7 @@ ISO14443_UPDATE_STATE PN5180ISO14443::update(){
 	else{
 		lastTagLength = uidLength;
 	}
-	for(int i = 0; i < 7; i++){
+	for(int i = 0; i < 10; i++){
 		if(tagData[i] != prevTagData[i]){
 			newState = ISO14443_UPDATED;
 			break;
@@ -79,6 +130,92 @@ ISO14443_UPDATE_STATE PN5180ISO14443::update(){
 	return newState;
 }
 
+/*
+ * Enable or disable the presence check in update(). When enabled, a card
+ * that was identified is halted with the RF field left on. Following calls
+ * to update() then only send a WUPA and a SELECT with the stored UID, which
+ * only the same card answers, falling back to the full REQA/anticollision/
+ * select cascade when it does not answer.
+ */
+void PN5180ISO14443::setPresenceCheck(bool enable){
+	presenceCheck = enable;
+	if (!enable && cardHalted) {
+		cardHalted = false;
+		setRF_off();
+	}
+}
+
+/*
+ * Check whether the halted card is still in the field.
+ * WUPA wakes up the card from HALT (and any newly arrived card), the SELECT
+ * with the stored UID is only answered by the same card. The following HLTA
+ * puts it back into HALT for the next check.
+ */
+bool PN5180ISO14443::checkPresence(){
+	if (!wakeupSelected()) {
+		if (tagCache && (selectedCard.uidLength > 0))
+		  tagCache->invalidate(selectedCard.uid, selectedCard.uidLength);
+		return false;
+	}
+	return mifareHalt();
+}
+
+/*
+ * WUPA, then SELECT of the stored UID through all cascade levels without
+ * anticollision. Other cards in the field stay in READY.
+ * return value: true if the card of the last activation is ACTIVE again
+ */
+bool PN5180ISO14443::wakeupSelected(){
+	uint8_t cmd[7];
+	if (selectedCard.uidLength == 0)
+	  return false;
+	// a MIFARE Classic read leaves Crypto1 on, the WUPA has to go out plain
+	mifareEndAuthentication();
+	// WUPA and ATQA are sent without CRC
+	if (!writeRegisterWithAndMask(CRC_RX_CONFIG, 0xFFFFFFFE))
+	  return false;
+	if (!writeRegisterWithAndMask(CRC_TX_CONFIG, 0xFFFFFFFE))
+	  return false;
+	clearIRQStatus(0xffffffff);
+	// Send WUPA, 7 bits in last byte
+	cmd[0] = 0x52;
+	if (!sendData(cmd, 1, 0x07))
+	  return false;
+	// the ATQA of several cards may collide, the SELECT tells them apart
+	if ((waitForRxBytes(ISO14443_RX_TIMEOUT_US) == 0) && (rxResult == ISO14443_NO_CARD))
+	  return false; // no answer, card is gone
+	if (!writeRegisterWithOrMask(CRC_RX_CONFIG, 0x01))
+	  return false;
+	if (!writeRegisterWithOrMask(CRC_TX_CONFIG, 0x01))
+	  return false;
+
+	uint8_t uidLength = selectedCard.uidLength;
+	uint8_t levels = (uidLength == 4) ? 1 : ((uidLength == 7) ? 2 : 3);
+	uint8_t pos = 0;
+	for (uint8_t level = 0; level < levels; level++) {
+		cmd[0] = 0x93 + 2 * level;
+		cmd[1] = 0x70;
+		// UID CLn: cascade tag 88(CT) and 3 bytes, 4 bytes on the last level
+		uint8_t n = 2;
+		if (level < levels - 1) cmd[n++] = 0x88;
+		while (n < 6) cmd[n++] = selectedCard.uid[pos++];
+		cmd[6] = cmd[2] ^ cmd[3] ^ cmd[4] ^ cmd[5]; // BCC
+		clearIRQStatus(0xffffffff);
+		if (!sendData(cmd, 7, 0x00))
+		  return false;
+		if (waitForRxBytes(ISO14443_RX_TIMEOUT_US) != 1)
+		  return false;
+		uint8_t sak;
+		if (!readData(1, &sak))
+		  return false;
+		// cascade bit of the SAK has to match the UID length
+		if (((sak & 0x04) != 0) != (level < levels - 1))
+		  return false;
+		if (level == levels - 1) selectedCard.sak = sak;
+	}
+	return true;
+}
+
 void PN5180ISO14443::printUID(){
 	printf("RFID %i tag data -- ", readerID);
 	for(int i = 0; i < lastTagLength; i++){
@@ -119,11 +256,12 @@ uint16_t PN5180ISO14443::rxBytesReceived() {
 
 
 /*
-* buffer : must be 10 byte array
+* buffer : must be 13 byte array
 * buffer[0-1] is ATQA
 * buffer[2] is sak
 * buffer[3..6] is 4 byte UID
 * buffer[7..9] is remaining 3 bytes of UID for 7 Byte UID tags
+* buffer[10..12] is remaining 3 bytes of UID for 10 Byte UID tags
 * kind : 0  we send REQA, 1 we send WUPA
 *
 * return value: the uid length:
@@ -132,7 +270,7 @@ uint16_t PN5180ISO14443::rxBytesReceived() {
 * - -2 card in field but with error
 * -	single Size UID (4 byte)
 * -	double Size UID (7 byte)
-* -	triple Size UID (10 byte) - not yet supported
+* -	triple Size UID (10 byte)
 */
 uint32_t timer;
 void printTime(const char* str){
@@ -141,20 +279,24 @@ void printTime(const char* str){
 	timer = millis();
 }
 
-int8_t PN5180ISO14443::activateTypeA(uint8_t *buffer, uint8_t kind) {
-	timer = millis();
-	uint8_t cmd[7];
-	uint8_t uidLength = 0;
+/*
+* Reset the PN5180, switch on the field and bring the transceiver into
+* WaitTransmit with crypto and CRC switched off, ready for REQA/WUPA.
+* return value: 0 on success, the activateTypeA error code otherwise
+*/
+int8_t PN5180ISO14443::prepareTypeA() {
+	selectedCard.uidLength = 0;
+	authSector = 0xFF;
 	reset();
 	// Load standard TypeA protocol already done in reset()
 	if (!loadRFConfig(0x0, 0x80)) {
 		Serial.println(F("*** ERROR: Load standard TypeA protocol failed!\n"));
-		return -2;
+		return activationFailed(ISO14443_STEP_RF_CONFIG, ISO14443_SPI_TIMEOUT, -2);
 	}
 	printTime("loadRFConfig");
 	// activate RF field
 	if(!setRF_on()){
-		return -4;
+		return activationFailed(ISO14443_STEP_RF_ON, ISO14443_SPI_TIMEOUT, -4);
 	};
 	
 	// printTime("setRF_on");
@@ -164,33 +306,33 @@ int8_t PN5180ISO14443::activateTypeA(uint8_t *buffer, uint8_t kind) {
 	// OFF Crypto
 	if (!writeRegisterWithAndMask(SYSTEM_CONFIG, 0xFFFFFFBF)) {
 		Serial.println(F("*** ERROR: OFF Crypto failed!\n"));
-		return -5;
+		return activationFailed(ISO14443_STEP_TRANSCEIVE, ISO14443_SPI_TIMEOUT, -5);
 	}
 	printTime("off crypto");
 	// clear RX CRC
 	if (!writeRegisterWithAndMask(CRC_RX_CONFIG, 0xFFFFFFFE)) {
 		Serial.println(F("*** ERROR: Clear RX CRC failed!\n"));
-		return -6;
+		return activationFailed(ISO14443_STEP_TRANSCEIVE, ISO14443_SPI_TIMEOUT, -6);
 	}
 	printTime("clear rx crc");
 	// clear TX CRC
 	if (!writeRegisterWithAndMask(CRC_TX_CONFIG, 0xFFFFFFFE)) {
 		Serial.println(F("*** ERROR: Clear TX CRC failed!\n"));
-		return -7;
+		return activationFailed(ISO14443_STEP_TRANSCEIVE, ISO14443_SPI_TIMEOUT, -7);
 	}
 	printTime("clear tx crc");
 
 	// set the PN5180 into IDLE state  
 	if (!writeRegisterWithAndMask(SYSTEM_CONFIG, 0xFFFFFFF8)) {
 		Serial.println(F("*** ERROR: set IDLE state failed!\n"));
-		return -8;
+		return activationFailed(ISO14443_STEP_TRANSCEIVE, ISO14443_SPI_TIMEOUT, -8);
 	}
 	printTime("set to idle");
 		
 	  // activate TRANSCEIVE routine  
 	if (!writeRegisterWithOrMask(SYSTEM_CONFIG, 0x00000003)) {
 		Serial.println(F("*** ERROR: Activates TRANSCEIVE routine failed!\n"));
-		return -9;
+		return activationFailed(ISO14443_STEP_TRANSCEIVE, ISO14443_SPI_TIMEOUT, -9);
 	}
 	printTime("activate tranceive");
 	// wait for wait-transmit state
@@ -198,9 +340,80 @@ int8_t PN5180ISO14443::activateTypeA(uint8_t *buffer, uint8_t kind) {
 	PN5180TransceiveStat transceiveState = getTransceiveState();
 	if (PN5180_TS_WaitTransmit != transceiveState) {
 		Serial.println(F("*** ERROR: Transceiver not in state WaitTransmit i mean what the H!?\n"));
-		return -3;
+		return activationFailed(ISO14443_STEP_TRANSCEIVE, ISO14443_SPI_TIMEOUT, -3);
 	}
 	printTime("wait for transmit");
+	return 0;
+}
+
+/*
+* Result of the last activation, see ISO14443Result. getLastStep() tells
+* in which step of the activation the failure happened.
+*/
+ISO14443Result PN5180ISO14443::getLastResult() {
+	return lastResult;
+}
+
+ISO14443Step PN5180ISO14443::getLastStep() {
+	return lastStep;
+}
+
+/*
+* Number of activations which ended with the given result since the last
+* call to resetResultCounts()
+*/
+uint16_t PN5180ISO14443::getResultCount(ISO14443Result result) {
+	if (result >= ISO14443_RESULT_COUNT)
+	  return 0;
+	return resultCount[result];
+}
+
+void PN5180ISO14443::resetResultCounts() {
+	for (int i = 0; i < ISO14443_RESULT_COUNT; i++)
+	  resultCount[i] = 0;
+}
+
+const __FlashStringHelper *PN5180ISO14443::strresult(ISO14443Result result) {
+	switch (result) {
+		case ISO14443_OK: return F("OK!");
+		case ISO14443_NO_CARD: return F("No card detected!");
+		case ISO14443_COLLISION: return F("Collision!");
+		case ISO14443_CRC_ERROR: return F("CRC error!");
+		case ISO14443_PROTOCOL_ERROR: return F("Protocol error!");
+		case ISO14443_SPI_TIMEOUT: return F("Reader not responding!");
+		default: return F("Undefined result in ISO14443!");
+	}
+}
+
+/*
+* Record the step and fault class of a failed activation and pass the
+* legacy return code through
+*/
+int8_t PN5180ISO14443::activationFailed(ISO14443Step step, ISO14443Result result, int8_t rc) {
+	lastStep = step;
+	lastResult = result;
+	return rc;
+}
+
+void PN5180ISO14443::countResult() {
+	if (resultCount[lastResult] < 0xFFFF)
+	  resultCount[lastResult]++;
+}
+
+int8_t PN5180ISO14443::activateTypeA(uint8_t *buffer, uint8_t kind) {
+	lastResult = ISO14443_OK;
+	lastStep = ISO14443_STEP_NONE;
+	int8_t rc = requestTypeA(buffer, kind);
+	countResult();
+	return rc;
+}
+
+int8_t PN5180ISO14443::requestTypeA(uint8_t *buffer, uint8_t kind) {
+	timer = millis();
+	uint8_t cmd[1];
+	int8_t rc = prepareTypeA();
+	if (rc != 0)
+	  return rc;
 	
 /*	uint8_t irqConfig = 0b0000000; // Set IRQ active low + clear IRQ-register
     writeEEprom(IRQ_PIN_CONFIG, &irqConfig, 1);
@@ -216,7 +429,7 @@ int8_t PN5180ISO14443::activateTypeA(uint8_t *buffer, uint8_t kind) {
 	cmd[0] = (kind == 0) ? 0x26 : 0x52;
 	if (!sendData(cmd, 1, 0x07)) {
 		Serial.println(F("*** ERROR: Send REQA/WUPA failed!\n"));
-		return 0;
+		return activationFailed(ISO14443_STEP_REQA, ISO14443_SPI_TIMEOUT, 0);
 	}
 	printTime("send reqa");
 	
@@ -228,177 +441,381 @@ int8_t PN5180ISO14443::activateTypeA(uint8_t *buffer, uint8_t kind) {
 	// READ 2 bytes ATQA into  buffers
 	if (!readData(2, buffer)) {
 		Serial.println(F("*** ERROR: READ 2 bytes ATQA failed!\n"));
-		return 0;
+		return activationFailed(ISO14443_STEP_REQA, ISO14443_SPI_TIMEOUT, 0);
 	}
 	printTime("read aqta");
 	// delay(2);
-	unsigned long startedWaiting = millis();
 	if(getTransceiveState() != PN5180_TS_WaitTransmit){
-		return -10; // means no tag, I think
+		return activationFailed(ISO14443_STEP_REQA, ISO14443_NO_CARD, -10);
 	}
-	// while (PN5180_TS_WaitTransmit != getTransceiveState()) {   
-	// 	if (millis() - startedWaiting > 5) {
-	// 		Serial.println(F("*** ERROR: timeout in PN5180_TS_WaitTransmit!\n"));
-	// 		return -1; 
-	// 	}	
-	// }
 	printTime("wait transmit, part 2");
-	
-	// clear all IRQs
-	clearIRQStatus(0xffffffff); 
-	printTime("clear irq, part 2");
-	
-	// send Anti collision 1, 8 bits in last byte
-	cmd[0] = 0x93;
-	cmd[1] = 0x20;
-	if (!sendData(cmd, 2, 0x00)) {
-		Serial.println(F("*** ERROR: Send Anti collision 1 failed!\n"));
-		return -2;
-	}
-	printTime("anti collision");
-	
-	// wait some mSecs for end of RF receiption
-	// delay(1);
-	timer = millis();
 
-	uint8_t numBytes = rxBytesReceived();
-	printTime("rxBytesReceived");
-	if (numBytes != 5) {
-		Serial.println(F("*** ERROR: Read 5 bytes sak failed!\n"));
-		return -47;
-	};
-	// read 5 bytes sak, we will store at offset 2 for later usage
-	if (!readData(5, cmd+2)) {
-		Serial.println("Read 5 bytes failed!");
-		return -2;
+	// Anticollision and select through all cascade levels
+	ISO14443Card card;
+	card.atqa[0] = buffer[0];
+	card.atqa[1] = buffer[1];
+	rc = selectTypeA(&card);
+	printTime("the long function");
+	if (rc == 0)
+	  return -47;
+	if (rc < 0)
+	  return -2;
+	buffer[2] = card.sak;
+	for (int i = 0; i < card.uidLength; i++)
+	  buffer[3 + i] = card.uid[i];
+	return card.uidLength;
+}
+
+/*
+* Enumerate all ISO14443A cards in the field.
+* Each card is resolved with the bit-oriented anticollision and halted
+* afterwards, so the next REQA is only answered by the remaining cards.
+* cards : array of maxCards records to store ATQA, SAK and UID
+*
+* return value: number of cards found, or the activateTypeA error code if
+* the reader could not be prepared or the first card failed to activate
+*/
+int8_t PN5180ISO14443::activateAllTypeA(ISO14443Card *cards, uint8_t maxCards) {
+	uint8_t cmd[1];
+	int8_t numCards = 0;
+	lastResult = ISO14443_OK;
+	lastStep = ISO14443_STEP_NONE;
+	int8_t rc = prepareTypeA();
+	if (rc != 0) {
+		countResult();
+		return rc;
 	}
-	printTime("5 bytes sak");
-	// We do have a card now! enable CRC and send anticollision
-	// save the first 4 bytes of UID
-	for (int i = 0; i < 4; i++){
-		buffer[i] = cmd[2 + i];
+
+	while (numCards < maxCards) {
+		ISO14443Card *card = &cards[numCards];
+		// REQA is sent without CRC
+		if (!writeRegisterWithAndMask(CRC_RX_CONFIG, 0xFFFFFFFE) ||
+		    !writeRegisterWithAndMask(CRC_TX_CONFIG, 0xFFFFFFFE)) {
+			activationFailed(ISO14443_STEP_REQA, ISO14443_SPI_TIMEOUT, 0);
+			break;
+		}
+		clearIRQStatus(0xffffffff);
+		//Send REQA, 7 bits in last byte, halted cards stay silent
+		cmd[0] = 0x26;
+		if (!sendData(cmd, 1, 0x07)) {
+			activationFailed(ISO14443_STEP_REQA, ISO14443_SPI_TIMEOUT, 0);
+			break;
+		}
+		if (0 == (waitForIRQ(RX_IRQ_STAT, ISO14443_RX_TIMEOUT_US) & RX_IRQ_STAT)) {
+			activationFailed(ISO14443_STEP_REQA, ISO14443_NO_CARD, 0);
+			break; // no more cards
+		}
+		// the ATQA of several cards may collide, it is not needed to continue
+		if (!readData(2, card->atqa)) {
+			activationFailed(ISO14443_STEP_REQA, ISO14443_SPI_TIMEOUT, 0);
+			break;
+		}
+		rc = selectTypeA(card);
+		if (rc <= 0) {
+			if (numCards == 0 && rc < 0) {
+				countResult();
+				return -2;
+			}
+			break;
+		}
+		numCards++;
+		mifareHalt();
 	}
-	
-	//Enable RX CRC calculation
-	if (!writeRegisterWithOrMask(CRC_RX_CONFIG, 0x01)) 
-	  return -2;
-	printTime("enable rx crc");
-	//Enable TX CRC calculation
-	if (!writeRegisterWithOrMask(CRC_TX_CONFIG, 0x01)) 
-	  return -2;
-	printTime("enable tx crc");
-
-	//Send Select anti collision 1, the remaining bytes are already in offset 2 onwards
-	cmd[0] = 0x93;
-	cmd[1] = 0x70;
-	if (!sendData(cmd, 7, 0x00)) {
-		// no remaining bytes, we have a 4 byte UID
-		return 4;
-	}
-	delay(1);
-	printTime("anti collision 2");
-	//Read 1 byte SAK into buffer[2]
-	if (!readData(1, buffer+2)) 
-	  return -2;
-	printTime("1 byte sak");
-	// Check if the tag is 4 Byte UID or 7 byte UID and requires anti collision 2
-	// If Bit 3 is 0 it is 4 Byte UID
-	if ((buffer[2] & 0x04) == 0) {
-		// Take first 4 bytes of anti collision as UID store at offset 3 onwards. job done
-		for (int i = 0; i < 4; i++) buffer[3+i] = cmd[2 + i];
-		uidLength = 4;
+	if (numCards > 0) {
+		// running out of cards ends the enumeration, it is not a failure
+		lastResult = ISO14443_OK;
+		lastStep = ISO14443_STEP_NONE;
 	}
-	else {
-		// Take First 3 bytes of UID, Ignore first byte 88(CT)
-		if (cmd[2] != 0x88)
-		  return 0;
-		for (int i = 0; i < 3; i++) buffer[3+i] = cmd[3 + i];
-		// Clear RX CRC
-		if (!writeRegisterWithAndMask(CRC_RX_CONFIG, 0xFFFFFFFE)) 
-	      return -2;
-		// Clear TX CRC
-		if (!writeRegisterWithAndMask(CRC_TX_CONFIG, 0xFFFFFFFE)) 
-	      return -2;
-		// Do anti collision 2
-		cmd[0] = 0x95;
-		cmd[1] = 0x20;
-		if (!sendData(cmd, 2, 0x00)) 
-	      return -2;
-		//Read 5 bytes. we will store at offset 2 for later use
-		if (!readData(5, cmd+2)) 
-	      return -2;
-		// first 4 bytes belongs to last 4 UID bytes, we keep it.
-		for (int i = 0; i < 4; i++) {
-		  buffer[6 + i] = cmd[2+i];
+	countResult();
+	return numCards;
+}
+
+/*
+* Set the number of bits of the first received byte which are already
+* known and therefore not received (RX_BIT_ALIGN in CRC_RX_CONFIG).
+*/
+bool PN5180ISO14443::setRxBitAlign(uint8_t bits) {
+	if (!writeRegisterWithAndMask(CRC_RX_CONFIG, ~RX_BIT_ALIGN_MASK))
+	  return false;
+	if (bits == 0)
+	  return true;
+	return writeRegisterWithOrMask(CRC_RX_CONFIG, ((uint32_t)bits << RX_BIT_ALIGN_SHIFT) & RX_BIT_ALIGN_MASK);
+}
+
+/*
+* Bit-oriented anticollision for one cascade level.
+* sel : select code of the cascade level (0x93, 0x95 or 0x97)
+* uidCL : 5 byte array, receives UID CLn and BCC of the selected card
+*
+* On a collision the bits up to the collision position are taken over from
+* the response, the colliding bit is set to 1 and the anticollision is
+* repeated with the longer known part of the UID, until a single card
+* answers with the complete UID CLn.
+*
+* return value: 1 on success, 0 if no card answered, -1 on error
+*/
+int8_t PN5180ISO14443::anticollisionLevel(uint8_t sel, uint8_t *uidCL) {
+	uint8_t cmd[7];
+	uint8_t rx[5];
+	uint8_t knownBits = 0;
+	for (int i = 0; i < 5; i++) uidCL[i] = 0;
+
+	// anticollision frames are sent without CRC
+	if (!writeRegisterWithAndMask(CRC_RX_CONFIG, 0xFFFFFFFE))
+	  return activationFailed(ISO14443_STEP_ANTICOLLISION, ISO14443_SPI_TIMEOUT, -1);
+	if (!writeRegisterWithAndMask(CRC_TX_CONFIG, 0xFFFFFFFE))
+	  return activationFailed(ISO14443_STEP_ANTICOLLISION, ISO14443_SPI_TIMEOUT, -1);
+
+	// every collision adds at least one known bit
+	for (int loop = 0; knownBits < 40; loop++) {
+		if (loop > 40)
+		  return activationFailed(ISO14443_STEP_ANTICOLLISION, ISO14443_COLLISION, -1);
+		uint8_t fullBytes = knownBits / 8;
+		uint8_t lastBits = knownBits % 8;
+		uint8_t sendBytes = fullBytes + ((lastBits > 0) ? 1 : 0);
+		cmd[0] = sel;
+		cmd[1] = ((2 + fullBytes) << 4) | lastBits; // NVB
+		for (int i = 0; i < sendBytes; i++) cmd[2 + i] = uidCL[i];
+
+		if (!setRxBitAlign(lastBits))
+		  return activationFailed(ISO14443_STEP_ANTICOLLISION, ISO14443_SPI_TIMEOUT, -1);
+		clearIRQStatus(0xffffffff);
+		if (!sendData(cmd, 2 + sendBytes, lastBits))
+		  return activationFailed(ISO14443_STEP_ANTICOLLISION, ISO14443_SPI_TIMEOUT, -1);
+		if (0 == (waitForIRQ(RX_IRQ_STAT, ISO14443_RX_TIMEOUT_US) & RX_IRQ_STAT)) {
+			setRxBitAlign(0);
+			return activationFailed(ISO14443_STEP_ANTICOLLISION, ISO14443_NO_CARD, 0);
+		}
+		uint32_t rxStatus;
+		if (!readRegister(RX_STATUS, &rxStatus))
+		  return activationFailed(ISO14443_STEP_ANTICOLLISION, ISO14443_SPI_TIMEOUT, -1);
+		uint16_t len = (uint16_t)(rxStatus & RX_BYTES_RECEIVED_MASK);
+		if (rxStatus & (RX_DATA_INTEGRITY_ERROR | RX_PROTOCOL_ERROR))
+		  return activationFailed(ISO14443_STEP_ANTICOLLISION, (rxStatus & RX_DATA_INTEGRITY_ERROR) ? ISO14443_CRC_ERROR : ISO14443_PROTOCOL_ERROR, -1);
+		if ((len == 0) || (fullBytes + len > 5))
+		  return activationFailed(ISO14443_STEP_ANTICOLLISION, ISO14443_PROTOCOL_ERROR, -1);
+		if (!readData(len, rx))
+		  return activationFailed(ISO14443_STEP_ANTICOLLISION, ISO14443_SPI_TIMEOUT, -1);
+
+		// take over the received bits, the first byte shares lastBits known bits
+		uint8_t knownMask = (1 << lastBits) - 1;
+		uidCL[fullBytes] = (uidCL[fullBytes] & knownMask) | (rx[0] & ~knownMask);
+		for (int i = 1; i < len; i++) uidCL[fullBytes + i] = rx[i];
+
+		if (rxStatus & RX_COLLISION_DETECTED) {
+			uint8_t collBit = fullBytes * 8 + ((rxStatus >> RX_COLL_POS_SHIFT) & RX_COLL_POS_MASK);
+			if ((collBit < knownBits) || (collBit >= 40))
+			  return activationFailed(ISO14443_STEP_ANTICOLLISION, ISO14443_COLLISION, -1);
+			PN5180DEBUG(F("Collision at bit "));
+			PN5180DEBUG(collBit);
+			PN5180DEBUG("\n");
+			// keep the valid bits below the collision and choose the card with a 1
+			uidCL[collBit / 8] &= (1 << (collBit % 8)) - 1;
+			uidCL[collBit / 8] |= (1 << (collBit % 8));
+			for (int i = collBit / 8 + 1; i < 5; i++) uidCL[i] = 0;
+			knownBits = collBit + 1;
+		}
+		else {
+			knownBits = 40;
 		}
+	}
+	if (!setRxBitAlign(0))
+	  return activationFailed(ISO14443_STEP_ANTICOLLISION, ISO14443_SPI_TIMEOUT, -1);
+	// check BCC
+	if ((uidCL[0] ^ uidCL[1] ^ uidCL[2] ^ uidCL[3]) != uidCL[4])
+	  return activationFailed(ISO14443_STEP_ANTICOLLISION, ISO14443_CRC_ERROR, -1);
+	return 1;
+}
+
+/*
+* Anticollision and select through cascade levels 1-3 for a card which
+* answered REQA/WUPA. card->atqa must already be filled by the caller.
+* On success the card is in ACTIVE state and RX/TX CRC is enabled.
+*
+* return value: the uid length (4, 7 or 10), 0 if no card answered the
+* anticollision, -1 on error
+*/
+int8_t PN5180ISO14443::selectTypeA(ISO14443Card *card) {
+	uint8_t cmd[7];
+	uint8_t uidLength = 0;
+	for (uint8_t level = 0; level < 3; level++) {
+		uint8_t sel = 0x93 + 2 * level;
+		int8_t rc = anticollisionLevel(sel, cmd + 2);
+		if (rc <= 0)
+		  return rc;
+
 		//Enable RX CRC calculation
 		if (!writeRegisterWithOrMask(CRC_RX_CONFIG, 0x01)) 
-	      return -2;
+		  return activationFailed(ISO14443_STEP_SELECT, ISO14443_SPI_TIMEOUT, -1);
 		//Enable TX CRC calculation
 		if (!writeRegisterWithOrMask(CRC_TX_CONFIG, 0x01)) 
-	      return -2;
-		//Send Select anti collision 2 
-		cmd[0] = 0x95;
+		  return activationFailed(ISO14443_STEP_SELECT, ISO14443_SPI_TIMEOUT, -1);
+		//Send Select, UID CLn and BCC are already in offset 2 onwards
+		cmd[0] = sel;
 		cmd[1] = 0x70;
-		if (!sendData(cmd, 7, 0x00)) 
-	      return -2;
-		//Read 1 byte SAK into buffer[2]
-		if (!readData(1, buffer + 2)) 
-	      return -2;
-		uidLength = 7;
+		clearIRQStatus(0xffffffff);
+		if (!sendData(cmd, 7, 0x00))
+		  return activationFailed(ISO14443_STEP_SELECT, ISO14443_SPI_TIMEOUT, -1);
+		if (waitForRxBytes(ISO14443_RX_TIMEOUT_US) != 1)
+		  return activationFailed(ISO14443_STEP_SELECT, (rxResult == ISO14443_OK) ? ISO14443_PROTOCOL_ERROR : rxResult, -1);
+		//Read 1 byte SAK
+		if (!readData(1, &card->sak))
+		  return activationFailed(ISO14443_STEP_SELECT, ISO14443_SPI_TIMEOUT, -1);
+
+		// If Bit 3 of SAK is 0 the UID is complete
+		if ((card->sak & 0x04) == 0) {
+			for (int i = 0; i < 4; i++) card->uid[uidLength++] = cmd[2 + i];
+			card->uidLength = uidLength;
+			selectedCard = *card;
+			return uidLength;
+		}
+		// UID not complete, first byte is the cascade tag 88(CT)
+		if (cmd[2] != 0x88)
+		  return activationFailed(ISO14443_STEP_SELECT, ISO14443_PROTOCOL_ERROR, -1);
+		for (int i = 0; i < 3; i++) card->uid[uidLength++] = cmd[3 + i];
 	}
-	printTime("the long function");
-    return uidLength;
+	return activationFailed(ISO14443_STEP_SELECT, ISO14443_PROTOCOL_ERROR, -1);
 }
 
 uint8_t *PN5180ISO14443::getTagData(){
 	return tagData;
 }
 
+/*
+* Length of the UID returned by getTagData(), 0 if no card was found by
+* the last update()
+*/
+uint8_t PN5180ISO14443::getTagLength(){
+	for (int i = 0; i < 10; i++) {
+		if (tagData[i] != 0) return lastTagLength;
+	}
+	return 0;
+}
+
+/*
+* Wait for the end of the reception of a frame.
+* return value: number of bytes received, 0 if nothing was received before
+* timeoutUs or the frame was received with an error, see rxResult
+*/
+uint16_t PN5180ISO14443::waitForRxBytes(uint32_t timeoutUs) {
+	uint32_t rxStatus;
+	if (0 == (waitForIRQ(RX_IRQ_STAT, timeoutUs) & RX_IRQ_STAT)) {
+		rxResult = ISO14443_NO_CARD;
+		return 0;
+	}
+	if (!readRegister(RX_STATUS, &rxStatus)) {
+		rxResult = ISO14443_SPI_TIMEOUT;
+		return 0;
+	}
+	if (rxStatus & RX_COLLISION_DETECTED) rxResult = ISO14443_COLLISION;
+	else if (rxStatus & RX_DATA_INTEGRITY_ERROR) rxResult = ISO14443_CRC_ERROR;
+	else if (rxStatus & RX_PROTOCOL_ERROR) rxResult = ISO14443_PROTOCOL_ERROR;
+	else {
+		rxResult = ISO14443_OK;
+		return (uint16_t)(rxStatus & RX_BYTES_RECEIVED_MASK);
+	}
+	return 0;
+}
+
+/*
+* Attach a cache for blocks read with mifareBlockRead, keyed by the UID of
+* the selected card. Pass 0L to detach the cache.
+*/
+void PN5180ISO14443::setTagCache(PN5180TagCache *cache) {
+	tagCache = cache;
+}
+
 bool PN5180ISO14443::mifareBlockRead(uint8_t blockno, uint8_t *buffer) {
-	bool success = false;
-	uint16_t len;
+	if (tagCache && (selectedCard.uidLength > 0) &&
+	    tagCache->lookup(selectedCard.uid, selectedCard.uidLength, blockno, buffer, 16))
+	  return true;
+	return mifareBlockReadFromTag(blockno, buffer);
+}
+
+bool PN5180ISO14443::mifareBlockReadFromTag(uint8_t blockno, uint8_t *buffer) {
 	uint8_t cmd[2];
 	// Send mifare command 30,blockno
 	cmd[0] = 0x30;
 	cmd[1] = blockno;
+	clearIRQStatus(0xffffffff);
 	if (!sendData(cmd, 2, 0x00))
 	  return false;
-	//Check if we have received any data from the tag
-	delay(5);
-	len = rxBytesReceived();
-	if (len == 16) {
-		// READ 16 bytes into  buffer
-		if (readData(16, buffer))
-		  success = true;
-	}
-	return success;
+	//Check if we have received 16 bytes from the tag, a NAK is only 4 bits
+	if (waitForRxBytes(MIFARE_READ_TIMEOUT_US) != 16)
+	  return false;
+	// READ 16 bytes into  buffer
+	if (!readData(16, buffer))
+	  return false;
+	if (tagCache && (selectedCard.uidLength > 0))
+	  tagCache->store(selectedCard.uid, selectedCard.uidLength, blockno, buffer, 16);
+	return true;
 }
 
+/*
+* Read numBlocks consecutive 16 byte blocks starting at firstBlock.
+* buffer : must hold numBlocks * 16 bytes
+*/
+bool PN5180ISO14443::mifareReadBlocks(uint8_t firstBlock, uint8_t numBlocks, uint8_t *buffer) {
+	for (int i = 0; i < numBlocks; i++) {
+		if (!mifareBlockRead(firstBlock + i, buffer + 16 * i))
+		  return false;
+	}
+	return true;
+}
 
+/*
+* Mifare write in two steps, each step is acknowledged by the tag with a
+* 4 bit ACK (0x0A) or NAK.
+* return value: 0x0A on success, the NAK of the failing step, or 0x00 if
+* the tag did not answer
+*/
 uint8_t PN5180ISO14443::mifareBlockWrite16(uint8_t blockno, uint8_t *buffer) {
 	uint8_t cmd[2];
-	// Clear RX CRC
-	writeRegisterWithAndMask(CRC_RX_CONFIG, 0xFFFFFFFE);
+	if (tagCache && (selectedCard.uidLength > 0)) {
+		// a READ of an Ultralight page returns the 3 following pages as well
+		for (int i = 0; (i < 4) && (i <= blockno); i++)
+		  tagCache->invalidate(selectedCard.uid, selectedCard.uidLength, blockno - i);
+	}
+	// Clear RX CRC, ACK/NAK is sent without CRC
+	if (!writeRegisterWithAndMask(CRC_RX_CONFIG, 0xFFFFFFFE))
+	  return 0x00;
 
 	// Mifare write part 1
 	cmd[0] = 0xA0;
 	cmd[1] = blockno;
-	sendData(cmd, 2, 0x00);
-	readData(1, cmd);
-
-	// Mifare write part 2
-	sendData(buffer,16, 0x00);
-	delay(10);
+	clearIRQStatus(0xffffffff);
+	if (sendData(cmd, 2, 0x00) && (waitForRxBytes(MIFARE_ACK_TIMEOUT_US) == 1) && readData(1, cmd)) {
+		cmd[0] &= 0x0F;
+	}
+	else cmd[0] = 0x00;
 
-	// Read ACK/NAK
-	readData(1, cmd);
+	if (cmd[0] == MIFARE_ACK) {
+		// Mifare write part 2, wait for ACK/NAK until the block is programmed
+		clearIRQStatus(0xffffffff);
+		if (sendData(buffer, 16, 0x00) && (waitForRxBytes(MIFARE_WRITE_TIMEOUT_US) == 1) && readData(1, cmd)) {
+			cmd[0] &= 0x0F;
+		}
+		else cmd[0] = 0x00;
+	}
 
 	//Enable RX CRC calculation
 	writeRegisterWithOrMask(CRC_RX_CONFIG, 0x1);
 	return cmd[0];
 }
 
+/*
+* Write numBlocks consecutive 16 byte blocks starting at firstBlock.
+* Stops at the first block which is not acknowledged.
+* return value: 0x0A on success, see mifareBlockWrite16 otherwise
+*/
+uint8_t PN5180ISO14443::mifareWriteBlocks(uint8_t firstBlock, uint8_t numBlocks, uint8_t *buffer) {
+	uint8_t ack = MIFARE_ACK;
+	for (int i = 0; (i < numBlocks) && (ack == MIFARE_ACK); i++) {
+		ack = mifareBlockWrite16(firstBlock + i, buffer + 16 * i);
+	}
+	return ack;
+}
+
 bool PN5180ISO14443::mifareHalt() {
 	uint8_t cmd[2];
 	//mifare Halt
@@ -408,16 +825,521 @@ bool PN5180ISO14443::mifareHalt() {
 	return true;
 }
 
+/*
+* MIFARE Classic
+*
+* Authentication is done by the PN5180 (MFC_AUTHENTICATE), afterwards
+* all data exchanged with the card is encrypted by Crypto1 until crypto is
+* switched off again. The authentication is valid for one sector, blocks
+* of the same sector are read and written without authenticating again.
+*
+* A failed authentication puts the card back to IDLE, so every trial
+* with a wrong key costs a re-activation (WUPA and SELECT). To avoid trial
+* authentications the key (A/B and index in the candidate list) which
+* last authenticated a sector is cached by UID and sector.
+*/
+static uint8_t mifareSector(uint8_t blockno) {
+	// 4 blocks per sector, MIFARE Classic 4K: 16 blocks per sector from block 128 on
+	return (blockno < 128) ? (blockno / 4) : (32 + (blockno - 128) / 16);
+}
+
+/*
+* Authenticate the sector of blockno on the selected card.
+* keyType : 0x60 for key A, 0x61 for key B
+* key : 6 byte key
+*/
+bool PN5180ISO14443::mifareAuthenticate(uint8_t blockno, uint8_t keyType, uint8_t *key) {
+	if (selectedCard.uidLength < 4)
+	  return false;
+	// the last 4 bytes of the UID are used for authentication
+	uint8_t status = mfcAuthenticate(blockno, keyType, key, selectedCard.uid + selectedCard.uidLength - 4);
+	if (status != 0x00) {
+		PN5180DEBUG(F("MIFARE authentication failed, status="));
+		PN5180DEBUG(status);
+		PN5180DEBUG("\n");
+		authSector = 0xFF;
+		return false;
+	}
+	authSector = mifareSector(blockno);
+	return true;
+}
+
+/*
+* Authenticate the sector of blockno on the selected card with one of
+* numKeys candidate keys, tried as key A and key B.
+* The sector stays authenticated for the following blocks, the key which
+* worked is cached for the next time the card is seen.
+*/
+bool PN5180ISO14443::mifareAuthenticate(uint8_t blockno, uint8_t keys[][6], uint8_t numKeys) {
+	uint8_t sector = mifareSector(blockno);
+	if (authSector == sector)
+	  return true; // session of this sector is still open
+	if (selectedCard.uidLength < 4)
+	  return false;
+	uint8_t *uid = selectedCard.uid + selectedCard.uidLength - 4;
+
+	MifareKeyCacheEntry *entry = findCachedKey(uid, sector);
+	if (entry && (entry->keyIndex < numKeys)) {
+		if (mifareAuthenticate(blockno, entry->keyType, keys[entry->keyIndex])) {
+			entry->lastUsed = ++keyCacheTick;
+			return true;
+		}
+		// key has been changed, fall back to trial authentication
+		if (!reactivate())
+		  return false;
+	}
+	for (uint8_t i = 0; i < numKeys; i++) {
+		for (uint8_t keyType = 0x60; keyType <= 0x61; keyType++) {
+			if (entry && (entry->keyIndex == i) && (entry->keyType == keyType))
+			  continue; // already tried
+			if (mifareAuthenticate(blockno, keyType, keys[i])) {
+				cacheKey(uid, sector, keyType, i);
+				return true;
+			}
+			if (!reactivate())
+			  return false;
+		}
+	}
+	return false;
+}
+
+/*
+* Authenticate if needed and read a 16 byte block of a MIFARE Classic card.
+*/
+bool PN5180ISO14443::mifareClassicRead(uint8_t blockno, uint8_t *buffer, uint8_t keys[][6], uint8_t numKeys) {
+	// a cached block needs no authentication
+	if (tagCache && (selectedCard.uidLength > 0) &&
+	    tagCache->lookup(selectedCard.uid, selectedCard.uidLength, blockno, buffer, 16))
+	  return true;
+	if (!mifareAuthenticate(blockno, keys, numKeys))
+	  return false;
+	return mifareBlockReadFromTag(blockno, buffer);
+}
+
+/*
+* Authenticate if needed and write a 16 byte block of a MIFARE Classic card.
+* return value: see mifareBlockWrite16, 0x00 if the authentication failed
+*/
+uint8_t PN5180ISO14443::mifareClassicWrite16(uint8_t blockno, uint8_t *buffer, uint8_t keys[][6], uint8_t numKeys) {
+	if (!mifareAuthenticate(blockno, keys, numKeys))
+	  return 0x00;
+	return mifareBlockWrite16(blockno, buffer);
+}
+
+/*
+* Close the authenticated session, switch off crypto.
+*/
+void PN5180ISO14443::mifareEndAuthentication() {
+	writeRegisterWithAndMask(SYSTEM_CONFIG, 0xFFFFFFBF);
+	authSector = 0xFF;
+}
+
+void PN5180ISO14443::clearKeyCache() {
+	for (int i = 0; i < MIFARE_KEY_CACHE_SIZE; i++) keyCache[i].keyType = 0;
+	keyCacheTick = 0;
+}
+
+MifareKeyCacheEntry *PN5180ISO14443::findCachedKey(uint8_t *uid, uint8_t sector) {
+	for (int i = 0; i < MIFARE_KEY_CACHE_SIZE; i++) {
+		MifareKeyCacheEntry *entry = &keyCache[i];
+		if ((entry->keyType != 0) && (entry->sector == sector) && (memcmp(entry->uid, uid, 4) == 0))
+		  return entry;
+	}
+	return 0L;
+}
+
+void PN5180ISO14443::cacheKey(uint8_t *uid, uint8_t sector, uint8_t keyType, uint8_t keyIndex) {
+	// replace the entry of this sector, a free entry or the least recently used one
+	MifareKeyCacheEntry *entry = findCachedKey(uid, sector);
+	if (0L == entry) {
+		entry = &keyCache[0];
+		for (int i = 0; i < MIFARE_KEY_CACHE_SIZE; i++) {
+			if (keyCache[i].keyType == 0) {
+				entry = &keyCache[i];
+				break;
+			}
+			if ((uint16_t)(keyCacheTick - keyCache[i].lastUsed) > (uint16_t)(keyCacheTick - entry->lastUsed))
+			  entry = &keyCache[i];
+		}
+	}
+	memcpy(entry->uid, uid, 4);
+	entry->sector = sector;
+	entry->keyType = keyType;
+	entry->keyIndex = keyIndex;
+	entry->lastUsed = ++keyCacheTick;
+}
+
+/*
+* Wake up and select the same card again after a failed authentication.
+* The RF field stays on: HLTA, WUPA and SELECT with the stored UID, no
+* reset of the PN5180 and no new anticollision.
+*/
+bool PN5180ISO14443::reactivate() {
+	mifareEndAuthentication();
+	mifareHalt();
+	return wakeupSelected();
+}
+
+/*
+* NTAG/Ultralight EV1 GET_VERSION (0x60)
+* version : must be 8 byte array, byte 6 is the storage size
+*/
+bool PN5180ISO14443::ntagGetVersion(uint8_t *version) {
+	uint8_t cmd[1] = { 0x60 };
+	clearIRQStatus(0xffffffff);
+	if (!sendData(cmd, 1, 0x00))
+	  return false;
+	if (waitForRxBytes(ISO14443_RX_TIMEOUT_US + 8 * ISO14443_BYTE_TIME_US) != 8)
+	  return false;
+	return readData(8, version);
+}
+
+/*
+* Number of pages of the selected NTAG/Ultralight EV1, derived from the
+* storage size in the GET_VERSION response.
+* return value: number of pages, 0 if GET_VERSION failed or the tag is unknown
+*/
+uint16_t PN5180ISO14443::ntagGetNumPages() {
+	uint8_t version[8];
+	if (!ntagGetVersion(version))
+	  return 0;
+	switch (version[6]) {
+		case 0x0B: return 20;  // Ultralight EV1 MF0UL11, NTAG210
+		case 0x0E: return 41;  // Ultralight EV1 MF0UL21, NTAG212
+		case 0x0F: return 45;  // NTAG213
+		case 0x11: return 135; // NTAG215
+		case 0x13: return 231; // NTAG216
+		default: return 0;
+	}
+}
+
+/*
+* Read numPages pages of 4 bytes starting at startPage with FAST_READ (0x3A).
+* Larger ranges are split into as few exchanges as the PN5180 RX buffer
+* allows, the data is read directly into buffer.
+* buffer : must hold numPages * 4 bytes
+*/
+bool PN5180ISO14443::ntagReadPages(uint8_t startPage, uint16_t numPages, uint8_t *buffer) {
+	uint8_t cmd[3];
+	while (numPages > 0) {
+		uint16_t pages = (numPages > NTAG_FAST_READ_MAX_PAGES) ? NTAG_FAST_READ_MAX_PAGES : numPages;
+		if (startPage + pages - 1 > 0xFF)
+		  return false;
+		uint16_t len = pages * 4;
+		cmd[0] = 0x3A;
+		cmd[1] = startPage;
+		cmd[2] = startPage + pages - 1;
+		clearIRQStatus(0xffffffff);
+		if (!sendData(cmd, 3, 0x00))
+		  return false;
+		if (waitForRxBytes(ISO14443_RX_TIMEOUT_US + (len + 2) * ISO14443_BYTE_TIME_US) != len)
+		  return false;
+		if (!readData(len, buffer))
+		  return false;
+		buffer += len;
+		startPage += pages;
+		numPages -= pages;
+	}
+	return true;
+}
+
+/*
+* Read the whole memory of the selected NTAG/Ultralight EV1, sized with
+* GET_VERSION.
+* return value: number of pages read, 0 on error or if buffer is too small
+*/
+uint16_t PN5180ISO14443::ntagReadAll(uint8_t *buffer, uint16_t bufferSize) {
+	uint16_t numPages = ntagGetNumPages();
+	if ((numPages == 0) || (numPages * 4 > bufferSize))
+	  return 0;
+	if (!ntagReadPages(0, numPages, buffer))
+	  return 0;
+	return numPages;
+}
+
+/*
+* ISO14443-4 (T=CL)
+*
+* RATS - Request for Answer To Select
+* Request format: E0, FSDI/CID, CRC
+* Response format: TL, T0, TA (opt.), TB (opt.), TC (opt.), historical bytes, CRC
+*
+*   T0:
+*    x654.3210
+*     |||\_ FSCI: max. frame size the card accepts
+*     ||\__ TA present: supported bit rates
+*     |\___ TB present: FWI, SFGI
+*     \____ TC present: NAD, CID support
+*
+* Frame sizes for FSDI/FSCI 0..8: 16, 24, 32, 40, 48, 64, 96, 128, 256 bytes
+* The frame waiting time is FWT = 302us * 2^FWI
+*/
+static const uint16_t iso14443FrameSize[] = { 16, 24, 32, 40, 48, 64, 96, 128, 256 };
+
+/*
+* Send RATS to the selected card and parse the ATS.
+* ats : optional, receives a copy of the ATS, must hold 256 bytes
+* return value: length of the ATS, 0 on error
+*/
+uint8_t PN5180ISO14443::rats(uint8_t *ats) {
+	// the PN5180 RX buffer takes the largest frame, FSDI=8 (256 bytes)
+	uint8_t cmd[2] = { 0xE0, (ISO14443_FSDI << 4) | 0x00 };
+	clearIRQStatus(0xffffffff);
+	if (!sendData(cmd, 2, 0x00))
+	  return 0;
+	// activation frame waiting time is 65536/fc (4.8ms)
+	uint16_t len = waitForRxBytes(ISO14443_ACTIVATION_FWT_US + 256 * ISO14443_BYTE_TIME_US);
+	if (len == 0)
+	  return 0;
+	uint8_t *rx = readData(len);
+	if (0L == rx)
+	  return 0;
+	uint8_t tl = rx[0];
+	if ((tl > len) || (tl == 0))
+	  return 0;
+	if (ats) memcpy(ats, rx, tl);
+
+	// defaults if the interface bytes are absent
+	uint8_t fsci = 2;
+	fwi = 4;
+	sfgi = 0;
+	atsTA = 0x00;
+	if (tl > 1) {
+		uint8_t t0 = rx[1];
+		uint8_t *p = &rx[2];
+		fsci = t0 & 0x0F;
+		if (t0 & 0x10) atsTA = *p++;
+		if (t0 & 0x20) {
+			fwi = (*p >> 4) & 0x0F;
+			sfgi = *p & 0x0F;
+			p++;
+		}
+		if (fwi > 14) fwi = 4;
+		if (sfgi > 14) sfgi = 0;
+	}
+	if (fsci > 8) fsci = 8;
+	fsc = iso14443FrameSize[fsci];
+	blockNumber = 0;
+
+	PN5180DEBUG(F("ATS: FSC="));
+	PN5180DEBUG(fsc);
+	PN5180DEBUG(F(", FWI="));
+	PN5180DEBUG(fwi);
+	PN5180DEBUG(F(", SFGI="));
+	PN5180DEBUG(sfgi);
+	PN5180DEBUG("\n");
+
+	// start-up frame guard time before the next frame
+	if (sfgi > 0) {
+		delay((302UL << sfgi) / 1000 + 1);
+	}
+	return tl;
+}
+
+/*
+* PPS - Protocol and Parameter Selection
+* Request format: D0|CID, PPS0 (0x11), PPS1 (DSI/DRI), CRC
+* Response format: D0|CID, CRC
+* On success the PN5180 is switched to the matching TX/RX configuration:
+* TX 0x00-0x03 and RX 0x80-0x83 for 106, 212, 424 and 848 kbit/s
+* dsi : bit rate card to reader
+* dri : bit rate reader to card
+*/
+bool PN5180ISO14443::pps(ISO14443BitRate dsi, ISO14443BitRate dri) {
+	uint8_t cmd[3] = { 0xD0, 0x11, (uint8_t)((dsi << 2) | dri) };
+	uint8_t ppss;
+	clearIRQStatus(0xffffffff);
+	if (!sendData(cmd, 3, 0x00))
+	  return false;
+	if (waitForRxBytes(fwtUs(1)) != 1)
+	  return false;
+	if (!readData(1, &ppss) || (ppss != 0xD0))
+	  return false;
+	if (!loadRFConfig(0x00 + dri, 0x80 + dsi))
+	  return false;
+	// the RF configuration defaults to CRC off
+	if (!writeRegisterWithOrMask(CRC_RX_CONFIG, 0x01))
+	  return false;
+	return writeRegisterWithOrMask(CRC_TX_CONFIG, 0x01);
+}
+
+/*
+* Activate ISO14443-4 on the selected card: RATS and PPS for the fastest
+* bit rate the card supports, up to maxBitRate.
+*/
+bool PN5180ISO14443::activateISO14443_4(ISO14443BitRate maxBitRate) {
+	if (rats() == 0)
+	  return false;
+
+	// TA: bit 7 same D for both directions, DS (card to reader) in bits 6-4,
+	// DR (reader to card) in bits 2-0, each for 212, 424 and 848 kbit/s
+	uint8_t dsi = 0, dri = 0;
+	for (uint8_t b = 1; b <= maxBitRate; b++) {
+		if (atsTA & (0x10 << (b - 1))) dsi = b;
+		if (atsTA & (0x01 << (b - 1))) dri = b;
+	}
+	if (atsTA & 0x80) {
+		dsi = dri = 0;
+		for (uint8_t b = 1; b <= maxBitRate; b++) {
+			if ((atsTA & (0x10 << (b - 1))) && (atsTA & (0x01 << (b - 1)))) dsi = dri = b;
+		}
+	}
+	if ((dsi == 0) && (dri == 0))
+	  return true; // stay at 106 kbit/s
+	return pps((ISO14443BitRate)dsi, (ISO14443BitRate)dri);
+}
+
+/*
+* Frame waiting time in us for the FWI of the card, multiplied by the
+* waiting time extension wtxm.
+*/
+uint32_t PN5180ISO14443::fwtUs(uint8_t wtxm) {
+	return ((302UL << fwi) * wtxm) + ISO14443_RX_TIMEOUT_US + (uint32_t)fsc * ISO14443_BYTE_TIME_US;
+}
+
+/*
+* Send one block and wait for the answer, S(WTX) requests of the card are
+* answered and the waiting time extended accordingly.
+* return value: length of the answer in the PN5180 read buffer, 0 on error
+*/
+uint16_t PN5180ISO14443::exchangeBlock(uint8_t *block, uint16_t blockLen, uint8_t **rx) {
+	uint8_t wtxm = 1;
+	uint8_t wtx[2];
+	for (;;) {
+		clearIRQStatus(0xffffffff);
+		if (!sendData(block, blockLen, 0x00))
+		  return 0;
+		uint16_t len = waitForRxBytes(fwtUs(wtxm));
+		if (len == 0)
+		  return 0;
+		*rx = readData(len);
+		if (0L == *rx)
+		  return 0;
+		if (((*rx)[0] & 0xF7) != 0xF2)
+		  return len;
+		// S(WTX): answer with the same WTXM and wait longer for the real answer
+		if (len < 2)
+		  return 0;
+		wtxm = (*rx)[1] & 0x3F;
+		if ((wtxm == 0) || (wtxm > 59))
+		  return 0;
+		wtx[0] = 0xF2;
+		wtx[1] = wtxm;
+		block = wtx;
+		blockLen = 2;
+	}
+}
+
+/*
+* Exchange a block with the error recovery of ISO14443-4 (7.5.4).
+* A timeout or an invalid answer is answered with R(NAK) (rule 4), or
+* with the R(ACK) again while the card is chaining (rule 5). An R(ACK)
+* with a block number other than ours asks for the last I-block again
+* (rule 6). Gives up after ISO14443_4_MAX_RETRIES retransmissions.
+* return value: length of the answer in the PN5180 read buffer, 0 on error
+*/
+uint16_t PN5180ISO14443::exchangeBlockRecover(uint8_t *block, uint16_t blockLen, uint8_t **rx, bool piccChaining) {
+	uint8_t nak[1] = { (uint8_t)(0xB2 | blockNumber) };
+	uint8_t *frame = block;
+	uint16_t frameLen = blockLen;
+	for (uint8_t retry = 0; ; retry++) {
+		uint16_t len = exchangeBlock(frame, frameLen, rx);
+		if (len > 0) {
+			bool rAck = (((*rx)[0] & 0xF6) == 0xA2);
+			if (!rAck || piccChaining || (((*rx)[0] & 0x01) == blockNumber))
+			  return len;
+			// the card did not receive our last I-block
+			PN5180DEBUG(F("ISO14443-4: retransmit I-block\n"));
+			frame = block;
+			frameLen = blockLen;
+		}
+		else {
+			PN5180DEBUG(F("ISO14443-4: no valid answer, "));
+			PN5180DEBUG(piccChaining ? F("R(ACK) again\n") : F("R(NAK)\n"));
+			if (!piccChaining) {
+				frame = nak;
+				frameLen = 1;
+			}
+		}
+		if (retry >= ISO14443_4_MAX_RETRIES)
+		  return 0;
+	}
+}
+
+/*
+* Exchange an APDU with the activated ISO14443-4 card.
+* The APDU is sent in I-blocks of up to FSC bytes with chaining, a chained
+* response is acknowledged with R(ACK) until the last block is received.
+* Lost or corrupted blocks are recovered, see exchangeBlockRecover().
+* return value: length of the response, -1 on error
+*/
+int16_t PN5180ISO14443::transceiveAPDU(uint8_t *apdu, uint16_t apduLen, uint8_t *response, uint16_t responseSize) {
+	uint8_t block[256];
+	uint8_t *rx;
+	uint16_t len;
+	// PCB and CRC take 3 bytes of the frame
+	uint16_t maxInf = fsc - 3;
+	uint16_t sent = 0;
+	for (;;) {
+		uint16_t chunk = apduLen - sent;
+		if (chunk > maxInf) chunk = maxInf;
+		bool chaining = (sent + chunk) < apduLen;
+		block[0] = 0x02 | blockNumber | (chaining ? 0x10 : 0x00);
+		memcpy(block + 1, apdu + sent, chunk);
+		len = exchangeBlockRecover(block, chunk + 1, &rx, false);
+		if (len == 0)
+		  return -1;
+		sent += chunk;
+		if (!chaining)
+		  break;
+		// R(ACK) for our chained block
+		if (((rx[0] & 0xF6) != 0xA2) || ((rx[0] & 0x01) != blockNumber))
+		  return -1;
+		blockNumber ^= 0x01;
+	}
+
+	uint16_t received = 0;
+	for (;;) {
+		// I-block with our block number
+		if (((rx[0] & 0xE2) != 0x02) || ((rx[0] & 0x01) != blockNumber))
+		  return -1;
+		blockNumber ^= 0x01;
+		if (received + len - 1 > responseSize)
+		  return -1;
+		memcpy(response + received, rx + 1, len - 1);
+		received += len - 1;
+		if (!(rx[0] & 0x10))
+		  return received;
+		// more to come, acknowledge with R(ACK)
+		block[0] = 0xA2 | blockNumber;
+		len = exchangeBlockRecover(block, 1, &rx, true);
+		if (len == 0)
+		  return -1;
+	}
+}
+
+/*
+* Send S(DESELECT) to put the card into HALT state.
+*/
+bool PN5180ISO14443::deselect() {
+	uint8_t cmd[1] = { 0xC2 };
+	uint8_t *rx;
+	if (exchangeBlock(cmd, 1, &rx) == 0)
+	  return false;
+	return (rx[0] & 0xF7) == 0xC2;
+}
+
 int8_t PN5180ISO14443::readCardSerial(uint8_t *buffer) {
   
-    uint8_t response[10];
+    uint8_t response[13];
 	int8_t uidLength;
-	// Always return 10 bytes
+	// Always return 13 bytes
     // Offset 0..1 is ATQA
     // Offset 2 is SAK.
-    // UID 4 bytes : offset 3 to 6 is UID, offset 7 to 9 to Zero
-    // UID 7 bytes : offset 3 to 9 is UID
-    for (int i = 0; i < 10; i++) response[i] = 0;
+    // UID 4 bytes : offset 3 to 6 is UID, offset 7 to 12 to Zero
+    // UID 7 bytes : offset 3 to 9 is UID, offset 10 to 12 to Zero
+    // UID 10 bytes : offset 3 to 12 is UID
+    for (int i = 0; i < 13; i++) response[i] = 0;
 	// try to activate Type A until response or timeout
 	uidLength = activateTypeA(response, 0);
 	// printf("uid length from activateTypeA -- %i\n", uidLength);
@@ -465,6 +1387,14 @@ int8_t PN5180ISO14443::readCardSerial(uint8_t *buffer) {
 			validUID = false;
 		};
 	};
+	if (uidLength == 10) {
+		if ((response[9] == 0x00) && (response[10] == 0x00) && (response[11] == 0x00) && (response[12] == 0x00)) {
+			validUID = false;
+		};
+		if ((response[9] == 0xFF) && (response[10] == 0xFF) && (response[11] == 0xFF) && (response[12] == 0xFF)) {
+			validUID = false;
+		};
+	};
 	if(uidLength > 10) validUID = false;
 //	mifareHalt();
 	if (validUID) {
@@ -20,6 +20,7 @@
 #define PN5180ISO14443_H
 
 #include "PN5180.h"
+#include "PN5180TagCache.h"
 
 enum ISO14443_UPDATE_STATE{
 	ISO14443_NOT_UPDATED,
@@ -27,6 +28,57 @@ enum ISO14443_UPDATE_STATE{
 	ISO14443_ERROR
 };
 
+// Fault class of the last ISO14443A activation
+enum ISO14443Result {
+	ISO14443_OK = 0,
+	ISO14443_NO_CARD,         // no answer to REQA/WUPA or during anticollision
+	ISO14443_COLLISION,       // unresolvable collision
+	ISO14443_CRC_ERROR,       // CRC/parity or BCC error
+	ISO14443_PROTOCOL_ERROR,  // unexpected frame length or content
+	ISO14443_SPI_TIMEOUT,     // reader not responding or not in the expected state
+	ISO14443_RESULT_COUNT
+};
+
+// Activation step in which the last ISO14443A activation failed
+enum ISO14443Step {
+	ISO14443_STEP_NONE = 0,
+	ISO14443_STEP_RF_CONFIG,
+	ISO14443_STEP_RF_ON,
+	ISO14443_STEP_TRANSCEIVE,
+	ISO14443_STEP_REQA,
+	ISO14443_STEP_ANTICOLLISION,
+	ISO14443_STEP_SELECT
+};
+
+// ISO14443-4 bit rates, index for DSI/DRI and the TX/RX configuration
+enum ISO14443BitRate {
+	ISO14443_106 = 0,
+	ISO14443_212 = 1,
+	ISO14443_424 = 2,
+	ISO14443_848 = 3
+};
+
+// ATQA, SAK and UID of an activated ISO14443A card
+struct ISO14443Card {
+	uint8_t atqa[2];
+	uint8_t sak;
+	uint8_t uidLength; // 4, 7 or 10
+	uint8_t uid[10];
+};
+
+#ifndef MIFARE_KEY_CACHE_SIZE
+#define MIFARE_KEY_CACHE_SIZE 16
+#endif
+
+// Key which last authenticated a sector of a MIFARE Classic card
+struct MifareKeyCacheEntry {
+	uint8_t uid[4];
+	uint8_t sector;
+	uint8_t keyType;  // 0x60 key A, 0x61 key B, 0 unused entry
+	uint8_t keyIndex; // index into the candidate key list
+	uint16_t lastUsed;
+};
+
 class PN5180ISO14443 : public PN5180 {
 
 public:
@@ -35,18 +87,85 @@ public:
 private:
   uint16_t rxBytesReceived();
   uint32_t GetNumberOfBytesReceivedAndValidBits();
-  uint8_t tagData[7] = {0, 0, 0, 0, 0, 0, 0};
+  uint8_t tagData[10] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
   uint8_t lastTagLength = 4;
+  bool presenceCheck = false;
+  bool cardHalted = false;
+  int8_t prepareTypeA();
+  bool setRxBitAlign(uint8_t bits);
+  int8_t anticollisionLevel(uint8_t sel, uint8_t *uidCL);
+  int8_t selectTypeA(ISO14443Card *card);
+  bool wakeupSelected();
+  uint16_t waitForRxBytes(uint32_t timeoutUs);
+  // result of the last activation
+  ISO14443Result lastResult = ISO14443_OK;
+  ISO14443Step lastStep = ISO14443_STEP_NONE;
+  ISO14443Result rxResult = ISO14443_OK;
+  uint16_t resultCount[ISO14443_RESULT_COUNT] = {};
+  int8_t activationFailed(ISO14443Step step, ISO14443Result result, int8_t rc);
+  void countResult();
+  int8_t requestTypeA(uint8_t *buffer, uint8_t kind);
+  // ISO14443-4 protocol parameters of the activated card
+  uint16_t fsc = 32;
+  uint8_t fwi = 4;
+  uint8_t sfgi = 0;
+  uint8_t atsTA = 0;
+  uint8_t blockNumber = 0;
+  uint32_t fwtUs(uint8_t wtxm);
+  uint16_t exchangeBlock(uint8_t *block, uint16_t blockLen, uint8_t **rx);
+  uint16_t exchangeBlockRecover(uint8_t *block, uint16_t blockLen, uint8_t **rx, bool piccChaining);
+  // MIFARE Classic authentication state and key cache
+  ISO14443Card selectedCard = {};
+  uint8_t authSector = 0xFF;
+  MifareKeyCacheEntry keyCache[MIFARE_KEY_CACHE_SIZE] = {};
+  uint16_t keyCacheTick = 0;
+  MifareKeyCacheEntry *findCachedKey(uint8_t *uid, uint8_t sector);
+  void cacheKey(uint8_t *uid, uint8_t sector, uint8_t keyType, uint8_t keyIndex);
+  bool reactivate();
+  PN5180TagCache *tagCache = 0L;
+  bool mifareBlockReadFromTag(uint8_t blockno, uint8_t *buffer);
 public:
   // Mifare TypeA
   ISO14443_UPDATE_STATE update();
   uint8_t* getTagData();
+  uint8_t getTagLength();
   void printUID();
   int8_t activateTypeA(uint8_t *buffer, uint8_t kind);
+  int8_t activateAllTypeA(ISO14443Card *cards, uint8_t maxCards);
   bool mifareBlockRead(uint8_t blockno,uint8_t *buffer);
+  bool mifareReadBlocks(uint8_t firstBlock, uint8_t numBlocks, uint8_t *buffer);
   uint8_t mifareBlockWrite16(uint8_t blockno, uint8_t *buffer);
+  uint8_t mifareWriteBlocks(uint8_t firstBlock, uint8_t numBlocks, uint8_t *buffer);
   bool mifareHalt();
+  // MIFARE Classic
+  bool mifareAuthenticate(uint8_t blockno, uint8_t keyType, uint8_t *key);
+  bool mifareAuthenticate(uint8_t blockno, uint8_t keys[][6], uint8_t numKeys);
+  bool mifareClassicRead(uint8_t blockno, uint8_t *buffer, uint8_t keys[][6], uint8_t numKeys);
+  uint8_t mifareClassicWrite16(uint8_t blockno, uint8_t *buffer, uint8_t keys[][6], uint8_t numKeys);
+  void mifareEndAuthentication();
+  void clearKeyCache();
+  // NTAG21x/Ultralight EV1
+  bool ntagGetVersion(uint8_t *version);
+  uint16_t ntagGetNumPages();
+  bool ntagReadPages(uint8_t startPage, uint16_t numPages, uint8_t *buffer);
+  uint16_t ntagReadAll(uint8_t *buffer, uint16_t bufferSize);
   bool errored();
+  // Result of the last activation
+  ISO14443Result getLastResult();
+  ISO14443Step getLastStep();
+  uint16_t getResultCount(ISO14443Result result);
+  void resetResultCounts();
+  const __FlashStringHelper *strresult(ISO14443Result result);
+  void setTagCache(PN5180TagCache *cache);
+  // ISO14443-4 (T=CL)
+  uint8_t rats(uint8_t *ats = 0);
+  bool pps(ISO14443BitRate dsi, ISO14443BitRate dri);
+  bool activateISO14443_4(ISO14443BitRate maxBitRate = ISO14443_848);
+  int16_t transceiveAPDU(uint8_t *apdu, uint16_t apduLen, uint8_t *response, uint16_t responseSize);
+  bool deselect();
+  // Presence check for an already selected card
+  void setPresenceCheck(bool enable);
+  bool checkPresence();
   /*
    * Helper functions
    */
@@ -22,6 +22,46 @@
 #include "PN5180ISO15693.h"
 #include "Debug.h"
 
+// 1 out of 4 coded request and high data rate response, both 26.48 kbit/s
+#define ISO15693_BYTE_TIME_US (302)
+// low data rate response, 6.62 kbit/s
+#define ISO15693_LOW_RATE_BYTE_TIME_US (1208)
+// VICC response delay t1
+#define ISO15693_T1_US (320)
+// SOF and EOF of request and response, incl. CRC16
+#define ISO15693_FRAME_OVERHEAD_US (1000)
+// EEPROM programming time of write and lock commands
+#define ISO15693_WRITE_TIME_US (20000)
+// SPI polling and tolerance of the VICC clock
+#define ISO15693_TIMEOUT_MARGIN_US (1000)
+// below this population estimate the inventory starts with a single slot
+#define ISO15693_SINGLE_SLOT_ESTIMATE (1.5)
+// above this population estimate almost every slot of an unmasked 16 slot
+// round collides, the inventory starts with the 16 masks of depth 1
+#define ISO15693_DEPTH1_ESTIMATE (64.0)
+// weight of the latest inventory in the population estimate
+#define ISO15693_ESTIMATE_WEIGHT (0.5)
+// inventory response: flags, DSFID, UID
+#define ISO15693_INVENTORY_RESPONSE_LEN (10)
+// FAST INVENTORY READ response, 52.97 kbit/s
+#define ISO15693_FAST_BYTE_TIME_US (151)
+// NXP IC manufacturer code
+#define ISO15693_MFG_NXP (0x04)
+
+// TX/RX configurations of the RF profiles, see PN5180::loadRFConfig()
+static const struct {
+  uint8_t txConf;
+  uint8_t rxConf;
+  bool fast; // custom FAST commands answer at 53 kbit/s
+} rfProfiles[ISO15693_PROFILE_COUNT] = {
+  { 0x0D, 0x8D, false }, // ISO15693_PROFILE_ASK100
+  { 0x0E, 0x8D, false }, // ISO15693_PROFILE_ASK10
+  { 0x0D, 0x8D, true  }, // ISO15693_PROFILE_ASK100_FAST
+  { 0x0E, 0x8D, true  }  // ISO15693_PROFILE_ASK10_FAST
+};
+// receiver configuration for 53 kbit/s responses
+#define ISO15693_FAST_RX_CONF (0x8E)
+
 PN5180ISO15693::PN5180ISO15693(uint8_t SSpin, uint8_t BUSYpin, uint8_t RSTpin, SPIClass& spi) 
               : PN5180(SSpin, BUSYpin, RSTpin, spi) {
 }
@@ -35,8 +75,8 @@ PN5180ISO15693::PN5180ISO15693(uint8_t SSpin, uint8_t BUSYpin, uint8_t RSTpin, S
  */
 ISO15693ErrorCode PN5180ISO15693::getInventory(uint8_t *uid) {
   //                     Flags,  CMD, maskLen
-  uint8_t inventory[] = { 0x26, 0x01, 0x00 };
-  //                        |\- inventory flag + high data rate
+  uint8_t inventory[] = { (uint8_t)(0x24 | requestFlags), 0x01, 0x00 };
+  //                        |\- inventory flag + data rate of the RF profile
   //                        \-- 1 slot: only one card, no AFI field present
   PN5180DEBUG(F("Get Inventory...\n"));
 
@@ -45,7 +85,8 @@ ISO15693ErrorCode PN5180ISO15693::getInventory(uint8_t *uid) {
   }
   
   uint8_t *readBuffer;
-  ISO15693ErrorCode rc = issueISO15693Command(inventory, sizeof(inventory), &readBuffer);
+  addressedUID = 0L;
+  ISO15693ErrorCode rc = issueISO15693Command(inventory, sizeof(inventory), &readBuffer, 10);
   if (ISO15693_EC_OK != rc) {
     return rc;
   }
@@ -75,71 +116,300 @@ ISO15693ErrorCode PN5180ISO15693::getInventory(uint8_t *uid) {
  * Request format: SOF, Req.Flags, Inventory, AFI (opt.), Mask len, Mask value, CRC16, EOF
  * Response format: SOF, Resp.Flags, DSFID, UID, CRC16, EOF
  */
+/*
+ * The collision tree is walked depth first with an explicit stack of
+ * (mask, length) entries, each collided slot pushes its mask extended by
+ * the 4 bit slot number. UIDs already found are not recorded twice and at
+ * most maxTags UIDs are written to uid (8 bytes each).
+ *
+ * The slot count and the mask depth of the first round are chosen from the
+ * population estimate of the previous inventories:
+ * - a single tag is expected: one 1 slot round, 16 slots only on collision
+ * - many tags are expected: start with the 16 masks of depth 1 instead of
+ *   an unmasked round in which nearly all slots collide
+ */
 ISO15693ErrorCode PN5180ISO15693::getInventoryMultiple(uint8_t *uid, uint8_t maxTags, uint8_t *numCard) {
   PN5180DEBUG("PN5180ISO15693: Get Inventory...");
-  uint16_t collision[maxTags];
+  inventoryOptions.command = 0x01;
+  inventoryOptions.numBlocks = 0;
+  return runInventory(uid, maxTags, numCard);
+}
+
+/*
+ * ICODE INVENTORY READ, code=A0 / FAST INVENTORY READ, code=A1
+ * see https://www.nxp.com/docs/en/data-sheet/SL2S2602.pdf
+ *
+ * Request format: SOF, Req.Flags, InventoryRead, IC Mfg code, AFI (opt.), Mask len, Mask value, FirstBlockNumber, numBlocks-1, CRC16, EOF
+ * Response format (option flag set): SOF, Resp.Flags, UID (without mask and Mfg code), BlockData, CRC16, EOF
+ *
+ * Inventory of NXP ICODE tags which returns numBlocks blocks starting at
+ * firstBlock of every tag in the same anticollision pass. The data of tag n
+ * is stored at blockData[n * numBlocks * blockSize], blockData has to hold
+ * maxTags * numBlocks * blockSize bytes.
+ * FAST INVENTORY READ answers with twice the data rate, it is used with
+ * fast=true or a FAST RF profile.
+ */
+ISO15693ErrorCode PN5180ISO15693::getInventoryRead(uint8_t *uid, uint8_t maxTags, uint8_t *numCard,
+                                                   uint8_t firstBlock, uint8_t numBlocks, uint8_t blockSize,
+                                                   uint8_t *blockData, bool fast) {
+  PN5180DEBUG("PN5180ISO15693: Inventory Read...");
+  if ((numBlocks == 0) || (blockSize == 0) || ((uint16_t)firstBlock + numBlocks > 256) ||
+      (1 + 6 + (uint16_t)numBlocks * blockSize > PN5180_RX_BUFFER_SIZE)) {
+    *numCard = 0;
+    return ISO15693_EC_OPTION_NOT_SUPPORTED;
+  }
+  fast = fast || rfProfiles[rfProfile].fast;
+  inventoryOptions.command = fast ? 0xA1 : 0xA0;
+  inventoryOptions.firstBlock = firstBlock;
+  inventoryOptions.numBlocks = numBlocks;
+  inventoryOptions.blockSize = blockSize;
+  inventoryOptions.blockData = blockData;
+  // the 53 kbit/s receiver only for the FAST responses
+  if (fast && !loadRFConfig(0xFF, ISO15693_FAST_RX_CONF)) {
+    return ISO15693_EC_UNKNOWN_ERROR;
+  }
+  ISO15693ErrorCode rc = runInventory(uid, maxTags, numCard);
+  if (fast) loadRFConfig(0xFF, rfProfiles[rfProfile].rxConf);
+  return rc;
+}
+
+ISO15693ErrorCode PN5180ISO15693::runInventory(uint8_t *uid, uint8_t maxTags, uint8_t *numCard) {
+  ISO15693ErrorCode rc = ISO15693_EC_OK;
   *numCard = 0;
-  uint8_t numCollisions = 0;
-  // Send an inventory command and listen for the response
-  inventoryPoll(uid, maxTags, numCard, &numCollisions, collision);
-  PN5180DEBUG("Number of collisions=");
-  PN5180DEBUG(numCollisions);
-  PN5180DEBUG("\n");
-	// Continue to call inventory until no further collisions detected
-	// (numCard will be incremented automatically on each call) 
-  while(numCollisions > 0){                                                 
+  collisionDepth = 0;
+  inventoryStats = ISO15693InventoryStats();
+  unsigned long startedUs = micros();
+  uint8_t firstRoundScale = 1;
+  // the walk starts at the UID prefix of the filter
+  uint64_t prefix = inventoryFilter.mask;
+  uint8_t prefixLen = inventoryFilter.maskLen;
+  uint8_t maxMaskLen = (inventoryOptions.numBlocks > 0) ? 48 : 64;
+  if (prefixLen > maxMaskLen) return ISO15693_EC_OPTION_NOT_SUPPORTED;
+
+  if (populationEstimate < ISO15693_SINGLE_SLOT_ESTIMATE) {
+    // a collision pushes the 16 slot round with the same mask
+    rc = inventoryPoll(uid, maxTags, numCard, prefix, prefixLen, 1);
+  }
+  else if ((populationEstimate > ISO15693_DEPTH1_ESTIMATE) && (collisionStackSize >= 16) &&
+           (prefixLen + 4 <= maxMaskLen)) {
+    // the first of the 16 rounds only sees 1/16 of the tags
+    firstRoundScale = 16;
+    for (int slot=15; slot>=0; slot--) {
+      pushCollision(prefix | ((uint64_t)slot << prefixLen), prefixLen + 4);
+    }
+  }
+  else pushCollision(prefix, prefixLen);
+
+  bool firstRound = true;
+  while ((ISO15693_EC_OK == rc) && (collisionDepth > 0) && (*numCard < maxTags)) {
+    ISO15693InventoryMask *next = &collisionStack[--collisionDepth];
 #ifdef DEBUG
-    printf("inventoryPoll: Polling with mask=0x%X\n", collision[0]);
+    printf("inventoryPoll: Polling with mask=0x%lX%08lX, length=%d\n", (unsigned long)(next->mask >> 32), (unsigned long)next->mask, next->length);
 #endif
-    inventoryPoll(uid, maxTags, numCard, &numCollisions, collision);
-    numCollisions--;
-    for(int i=0; i<numCollisions; i++){
-      collision[i] = collision[i+1];
+    uint16_t singles = inventoryStats.singleSlots;
+    uint16_t collisions = inventoryStats.collisionSlots;
+    rc = inventoryPoll(uid, maxTags, numCard, next->mask, next->length, 16);
+    if (firstRound) {
+      inventoryStats.firstRoundSingles = (inventoryStats.singleSlots - singles) * firstRoundScale;
+      inventoryStats.firstRoundCollisions = (inventoryStats.collisionSlots - collisions) * firstRoundScale;
+      firstRound = false;
     }
   }
-  return ISO15693_EC_OK;
+  PN5180DEBUG("Masks left=");
+  PN5180DEBUG(collisionDepth);
+  PN5180DEBUG("\n");
+  inventoryStats.durationUs = micros() - startedUs;
+  updatePopulationEstimate(*numCard, maxTags);
+  // tags behind a dropped mask were never polled
+  if ((ISO15693_EC_OK == rc) && (*numCard < maxTags) && (inventoryStats.droppedMasks > 0)) {
+    return EC_INVENTORY_INCOMPLETE;
+  }
+  // every tag of the filter answered, the others are gone (or in AFI
+  // inventories, may belong to another application family)
+  if ((ISO15693_EC_OK == rc) && (*numCard < maxTags) && !inventoryFilter.useAfi) {
+    dropMissingSecurityEntries(uid, *numCard);
+  }
+  return rc;
+}
+
+/*
+ * Push a mask which still has to be polled, masks which do not fit the
+ * stack are dropped and counted in the inventory statistics
+ */
+void PN5180ISO15693::pushCollision(uint64_t mask, uint8_t length) {
+  if (collisionDepth >= collisionStackSize) {
+    inventoryStats.droppedMasks++;
+    return;
+  }
+  collisionStack[collisionDepth].mask = mask;
+  collisionStack[collisionDepth].length = length;
+  collisionDepth++;
+}
+
+/*
+ * Carry the number of tags across inventories. If the inventory ended at
+ * maxTags the count is only a lower bound, the population is then estimated
+ * from the first 16 slot round with Schoute's estimator (2.39 tags per
+ * collided slot).
+ */
+void PN5180ISO15693::updatePopulationEstimate(uint8_t numCard, uint8_t maxTags) {
+  float population = numCard;
+  if (numCard >= maxTags) {
+    float schoute = inventoryStats.firstRoundSingles + 2.39 * inventoryStats.firstRoundCollisions;
+    if (schoute > population) population = schoute;
+  }
+  populationEstimate += ISO15693_ESTIMATE_WEIGHT * (population - populationEstimate);
+  PN5180DEBUG("Population estimate=");
+  PN5180DEBUG(populationEstimate);
+  PN5180DEBUG("\n");
+}
+
+/*
+ * Restrict getInventoryMultiple() and getInventoryRead() to tags with the
+ * given AFI, tags of other application families stay silent
+ */
+void PN5180ISO15693::setInventoryAFI(uint8_t afi) {
+  inventoryFilter.useAfi = true;
+  inventoryFilter.afi = afi;
+}
+
+/*
+ * Restrict getInventoryMultiple() and getInventoryRead() to tags whose UID
+ * starts with the first maskLen bits of uidPrefix (LSB first, as the UIDs
+ * returned by the inventory). maskLen=0 removes the restriction.
+ */
+void PN5180ISO15693::setInventoryMask(const uint8_t *uidPrefix, uint8_t maskLen) {
+  if (maskLen > 64) maskLen = 64;
+  uint64_t mask = 0;
+  for (int i=0; i<(maskLen + 7) / 8; i++) {
+    mask |= (uint64_t)uidPrefix[i] << (8*i);
+  }
+  if (maskLen < 64) mask &= ((uint64_t)1 << maskLen) - 1;
+  inventoryFilter.mask = mask;
+  inventoryFilter.maskLen = maskLen;
+}
+
+void PN5180ISO15693::clearInventoryFilter() {
+  inventoryFilter.useAfi = false;
+  inventoryFilter.afi = 0;
+  inventoryFilter.mask = 0;
+  inventoryFilter.maskLen = 0;
+}
+
+/*
+ * Tags expected by the next getInventoryMultiple()
+ */
+float PN5180ISO15693::getPopulationEstimate() {
+  return populationEstimate;
+}
+
+void PN5180ISO15693::setPopulationEstimate(float estimate) {
+  populationEstimate = (estimate < 0) ? 0 : estimate;
+}
+
+/*
+ * Use a caller provided collision stack, e.g. for inventories of more than
+ * ISO15693_INVENTORY_MAX_TAGS tags: 16 + maxTags / 2 masks.
+ * stack=0L returns to the built-in stack.
+ */
+void PN5180ISO15693::setCollisionStack(ISO15693InventoryMask *stack, uint16_t size) {
+  if ((0L == stack) || (size == 0)) {
+    collisionStack = defaultCollisionStack;
+    collisionStackSize = ISO15693_COLLISION_STACK_SIZE;
+  }
+  else {
+    collisionStack = stack;
+    collisionStackSize = size;
+  }
+}
+
+/*
+ * Slot statistics of the last getInventoryMultiple()
+ */
+const ISO15693InventoryStats &PN5180ISO15693::getInventoryStats() {
+  return inventoryStats;
 }
 
 /**
  * https://www.nxp.com.cn/docs/en/application-note/AN12650.pdf
  * 4.2.1 Example Code and 4.2.2 Description
+ *
+ * One inventory round with numSlots (1 or 16) slots for the tags whose UID
+ * starts (LSB first) with the maskLen bits of mask. Collided slots are
+ * pushed on the collision stack.
  */
-ISO15693ErrorCode PN5180ISO15693::inventoryPoll(uint8_t *uid, uint8_t maxTags, uint8_t *numCard, uint8_t *numCol, uint16_t *collision){
-  uint8_t maskLen = 0;
-  if(*numCol > 0){
-    uint32_t mask = collision[0];
-    do{
-      mask >>= 4L;
-      maskLen++;
-    }while(mask > 0);
-  } 
-  uint8_t *p = (uint8_t*)&(collision[0]);
-  //                      Flags,  CMD,
-  uint8_t inventory[7] = { 0x06, 0x01, maskLen*4, p[0], p[1], p[2], p[3] };
-  //                         |\- inventory flag + high data rate
-  //                         \-- 16 slots: upto 16 cards, no AFI field present
-  uint8_t cmdLen = 3 + (maskLen/2) + (maskLen%2);
+ISO15693ErrorCode PN5180ISO15693::inventoryPoll(uint8_t *uid, uint8_t maxTags, uint8_t *numCard, uint64_t mask, uint8_t maskLen, uint8_t numSlots){
+  bool inventoryRead = (inventoryOptions.numBlocks > 0);
+  //                       Flags,  CMD, (Mfg,) (AFI,) maskLen, mask (upto 8 bytes), (1stBlock, blocks-1)
+  uint8_t inventory[16] = { (uint8_t)(0x04 | requestFlags), 0x01 };
+  //                          |\- inventory flag + data rate of the RF profile
+  //                          \-- 16 slots: upto 16 cards, no AFI field present
+  if (numSlots == 1) inventory[0] |= 0x20; // 1 slot
+  uint8_t cmdLen = 2;
+  if (inventoryRead) {
+    inventory[0] |= 0x40; // option flag: the response contains the UID
+    inventory[1] = inventoryOptions.command;
+    inventory[cmdLen++] = ISO15693_MFG_NXP;
+  }
+  if (inventoryFilter.useAfi) {
+    inventory[0] |= 0x10; // AFI flag: only tags with this AFI answer
+    inventory[cmdLen++] = inventoryFilter.afi;
+  }
+  inventory[cmdLen++] = maskLen;
+  uint8_t maskBytes = (maskLen + 7) / 8;
+  for (int i=0; i<maskBytes; i++) {
+    inventory[cmdLen++] = (uint8_t)(mask >> (8*i));
+  }
+  // INVENTORY READ returns the UID bytes not covered by the mask
+  uint8_t uidBytes = 6 - maskLen / 8;
+  uint16_t responseLen = ISO15693_INVENTORY_RESPONSE_LEN;
+  uint16_t responseByteTime = ISO15693_BYTE_TIME_US;
+  if (inventoryRead) {
+    inventory[cmdLen++] = inventoryOptions.firstBlock;
+    inventory[cmdLen++] = inventoryOptions.numBlocks - 1;
+    responseLen = 1 + uidBytes + inventoryOptions.numBlocks * inventoryOptions.blockSize;
+    if (inventoryOptions.command == 0xA1) responseByteTime = ISO15693_FAST_BYTE_TIME_US;
+  }
 #ifdef DEBUG
-  printf("inventoryPoll inputs: maxTags=%d, numCard=%d, numCol=%d\n", maxTags, *numCard, *numCol);
-  printf("mask=%d, maskLen=%d, cmdLen=%d\n", p[0], maskLen, cmdLen);
+  printf("inventoryPoll inputs: maxTags=%d, numCard=%d, stack=%d\n", maxTags, *numCard, collisionDepth);
+  printf("maskLen=%d, cmdLen=%d\n", maskLen, cmdLen);
 #endif
+  // the slots after the first one are started with an EOF only frame,
+  // the TX configuration is restored after the last slot
+  uint32_t txConfig;
+  if (!readRegister(TX_CONFIG, &txConfig)) {
+    return ISO15693_EC_UNKNOWN_ERROR;
+  }
   clearIRQStatus(0x000FFFFF);                                      // 3. Clear all IRQ_STATUS flags
   sendData(inventory, cmdLen, 0);                                  // 4. 5. 6. Idle/StopCom Command, Transceive Command, Inventory command
+  uint32_t sofTimeout = (uint32_t)cmdLen * ISO15693_BYTE_TIME_US + ISO15693_T1_US
+                      + ISO15693_FRAME_OVERHEAD_US + ISO15693_TIMEOUT_MARGIN_US;
 
-  for(int slot=0; slot<16; slot++){                                // 7. Loop to check 16 time slots for data
+  ISO15693ErrorCode rc = ISO15693_EC_OK;
+  inventoryStats.rounds++;
+  for(int slot=0; slot<numSlots; slot++){                          // 7. Loop to check 16 time slots for data
+    inventoryStats.slots++;
     uint32_t rxStatus;
-    uint32_t irqStatus = getIRQStatus();
+    // a tag answers t1 after the EOF, wait for the end of its response
+    uint32_t irqStatus = waitForIRQ(RX_SOF_DET_IRQ_STAT | RX_IRQ_STAT, sofTimeout);
+    if ((irqStatus & RX_SOF_DET_IRQ_STAT) && !(irqStatus & RX_IRQ_STAT)) {
+      irqStatus = waitForIRQ(RX_IRQ_STAT, (uint32_t)responseLen * responseByteTime
+                                          + ISO15693_FRAME_OVERHEAD_US + ISO15693_TIMEOUT_MARGIN_US);
+    }
     readRegister(RX_STATUS, &rxStatus);
-    uint16_t len = (uint16_t)(rxStatus & 0x000001ff);
-    if((rxStatus >> 18) & 0x01 && *numCol < maxTags){              // 7+ Determine if a collision occurred
-      if(maskLen > 0) collision[*numCol] = collision[0] | (slot << (maskLen * 2));
-      else collision[*numCol] = slot << (maskLen * 2); // Yes, store position of collision
-      *numCol = *numCol + 1;
+    uint16_t len = (uint16_t)(rxStatus & RX_BYTES_RECEIVED_MASK);
+    if (rxStatus & (RX_COLLISION_DETECTED | RX_DATA_INTEGRITY_ERROR)){ // 7+ Determine if a collision occurred
+      inventoryStats.collisionSlots++;
+      // a 1 slot round is repeated with 16 slots, a 16 slot round extends
+      // the mask by the slot number (INVENTORY READ: not into the Mfg code)
+      if (numSlots == 1) pushCollision(mask, maskLen);
+      else if (maskLen + 4 <= (inventoryRead ? 48 : 64)) pushCollision(mask | ((uint64_t)slot << maskLen), maskLen + 4);
 #ifdef DEBUG
-      printf("Collision detected for UIDs matching %X starting at LSB", collision[*numCol-1]);
+      printf("Collision detected in slot %d\n", slot);
 #endif
     }
     else if(!(irqStatus & RX_IRQ_STAT) && !len){                   // 8. Check if a card has responded
+      inventoryStats.emptySlots++;
       PN5180DEBUG("getInventoryMultiple: No card in this time slot. State=");
       PN5180DEBUG(irqStatus);
       PN5180DEBUG("\n");
@@ -150,6 +420,11 @@ ISO15693ErrorCode PN5180ISO15693::inventoryPoll(uint8_t *uid, uint8_t maxTags, u
 #endif
       uint8_t *readBuffer;
       readBuffer = readData(len+1);                                // 9. Read reception buffer
+      if(0L == readBuffer){
+        PN5180DEBUG("getInventoryMultiple: ERROR in readData!");
+        rc = ISO15693_EC_UNKNOWN_ERROR;
+        break;
+      }
 #ifdef DEBUG
       printf("readBuffer= ");
       for(int i=0; i<len+1; i++){
@@ -159,17 +434,38 @@ ISO15693ErrorCode PN5180ISO15693::inventoryPoll(uint8_t *uid, uint8_t maxTags, u
       }
       printf("\n");
 #endif
-      if(0L == readBuffer){
-        PN5180DEBUG("getInventoryMultiple: ERROR in readData!");
-        return ISO15693_EC_UNKNOWN_ERROR;
-      }
 
+      inventoryStats.singleSlots++;
       // Record raw UID data                                       // 10. Record all data to Inventory struct
-      for (int i=0; i<8; i++) {
-        uint8_t startAddr = (*numCard * 8) + i;
-        uid[startAddr] = readBuffer[2+i];
+      uint8_t tagUid[8];
+      uint8_t *data = 0L;
+      if (inventoryRead) {
+        // mask bytes, returned UID bytes, Mfg code, E0
+        for (int i=0; i<8; i++) {
+          tagUid[i] = (uint8_t)(mask >> (8*i));
+        }
+        for (int i=0; i<uidBytes; i++) {
+          tagUid[6 - uidBytes + i] = readBuffer[1+i];
+        }
+        tagUid[6] = ISO15693_MFG_NXP;
+        tagUid[7] = 0xE0;
+        data = &readBuffer[1 + uidBytes];
+      }
+      else memcpy(tagUid, &readBuffer[2], 8);
+      if ((len < responseLen) || (readBuffer[0] & 0x01)) {
+        PN5180DEBUG("getInventoryMultiple: short or error response\n");
+      }
+      else if (isKnownUID(uid, *numCard, tagUid)) {
+        inventoryStats.duplicates++;
+      }
+      else if (*numCard < maxTags) {
+        memcpy(&uid[*numCard * 8], tagUid, 8);
+        if (inventoryRead) {
+          uint16_t dataLen = inventoryOptions.numBlocks * inventoryOptions.blockSize;
+          memcpy(&inventoryOptions.blockData[*numCard * dataLen], data, dataLen);
+        }
+        *numCard = *numCard + 1;
       }
-      *numCard = *numCard + 1;
 
 #ifdef DEBUG
       printf("getInventoryMultiple: Response flags: 0x%X, Data Storage Format ID: 0x%X\n", readBuffer[0], readBuffer[1]);
@@ -177,15 +473,38 @@ ISO15693ErrorCode PN5180ISO15693::inventoryPoll(uint8_t *uid, uint8_t maxTags, u
 #endif
     }
 
-    if(slot+1 < 16){ // If we have more cards to poll for...
+    if(slot+1 < numSlots){ // If we have more cards to poll for...
       writeRegisterWithAndMask(TX_CONFIG, 0xFFFFFB3F);             // 11. Next SEND_DATA will only include EOF
       clearIRQStatus(0x000FFFFF);                                  // 14. Clear all IRQ_STATUS flags
       sendData(inventory, 0, 0);                                   // 12. 13. 15. Idle/StopCom Command, Transceive Command, Send EOF
+      sofTimeout = ISO15693_T1_US + ISO15693_FRAME_OVERHEAD_US + ISO15693_TIMEOUT_MARGIN_US;
     }
   }
-  setRF_off();                                                     // 16. Switch off RF field
-  setupRF();                                                       // 1. 2. Load ISO15693 config, RF on
-  return ISO15693_EC_OK;
+  // 16. Keep the RF field on, the tags stay in Ready state and the next
+  // round needs no RF config reload and field ramp up
+  if (!writeRegister(TX_CONFIG, txConfig)) {
+    return ISO15693_EC_UNKNOWN_ERROR;
+  }
+  writeRegisterWithAndMask(SYSTEM_CONFIG, 0xfffffff8);             // Idle/StopCom Command
+  writeRegisterWithOrMask(SYSTEM_CONFIG, 0x00000003);              // Transceive Command
+  return rc;
+}
+
+bool PN5180ISO15693::isKnownUID(uint8_t *uid, uint8_t numCard, uint8_t *candidate) {
+  for (int n=0; n<numCard; n++) {
+    if (0 == memcmp(&uid[n*8], candidate, 8)) return true;
+  }
+  return false;
+}
+
+/*
+ * Switch the RF field off and on again. All tags in the field lose their
+ * state and return to Ready, e.g. after STAY QUIET.
+ */
+bool PN5180ISO15693::resetField() {
+  tagSelected = false;
+  if (!setRF_off()) return false;
+  return setupRF();
 }
 
 
@@ -195,6 +514,9 @@ ISO15693ErrorCode PN5180ISO15693::inventoryPoll(uint8_t *uid, uint8_t maxTags, u
  * Read single block, code=20
  *
  * Request format: SOF, Req.Flags, ReadSingleBlock, UID (opt.), BlockNumber, CRC16, EOF
+ *
+ * Block numbers above 255 use Extended read single block, code=30, with a
+ * 2 byte BlockNumber (LSB first).
  * Response format:
  *  when ERROR flag is set:
  *    SOF, Resp.Flags, ErrorCode, CRC16, EOF
@@ -219,38 +541,42 @@ ISO15693ErrorCode PN5180ISO15693::inventoryPoll(uint8_t *uid, uint8_t maxTags, u
  *  when ERROR flag is NOT set:
  *    SOF, Flags, BlockData (len=blockLength), CRC16, EOF
  */
-ISO15693ErrorCode PN5180ISO15693::readSingleBlock(uint8_t *uid, uint8_t blockNo, uint8_t *blockData, uint8_t blockSize) {
-  //                            flags, cmd, uid,             blockNo
-  uint8_t readSingleBlock[] = { 0x22, 0x20, 1,2,3,4,5,6,7,8, blockNo }; // UID has LSB first!
-  //                              |\- high data rate
-  //                              \-- no options, addressed by UID
-  for (int i=0; i<8; i++) {
-    readSingleBlock[2+i] = uid[i];
+ISO15693ErrorCode PN5180ISO15693::readSingleBlock(uint8_t *uid, uint16_t blockNo, uint8_t *blockData, uint8_t blockSize) {
+  if (tagCache && tagCache->lookup(uid, 8, blockNo, blockData, blockSize)) {
+    return ISO15693_EC_OK;
   }
 
+  //          flags, cmd, uid (opt.), blockNo
+  bool extended = (blockNo > 255);
+  uint8_t pos = buildHeader(extended ? 0x30 : 0x20, uid);
+  frame[pos++] = blockNo & 0xff;
+  if (extended) frame[pos++] = blockNo >> 8;
+
 #ifdef DEBUG
   PN5180DEBUG("Read Single Block #");
   PN5180DEBUG(blockNo);
   PN5180DEBUG(", size=");
   PN5180DEBUG(blockSize);
   PN5180DEBUG(": ");
-  for (int i=0; i<sizeof(readSingleBlock); i++) {
+  for (int i=0; i<pos; i++) {
     PN5180DEBUG(" ");
-    PN5180DEBUG(formatHex(readSingleBlock[i]));
+    PN5180DEBUG(formatHex(frame[i]));
   }
   PN5180DEBUG("\n");
 #endif
 
   uint8_t *resultPtr;
-  ISO15693ErrorCode rc = issueISO15693Command(readSingleBlock, sizeof(readSingleBlock), &resultPtr);
+  ISO15693ErrorCode rc = issueISO15693Command(frame, pos, &resultPtr, 1 + blockSize);
   if (ISO15693_EC_OK != rc) {
+    // tag left the field, its cached blocks may change before it returns
+    if (tagCache && (EC_NO_CARD == rc)) tagCache->invalidate(uid, 8);
     return rc;
   }
 
   PN5180DEBUG("Value=");
   
   for (int i=0; i<blockSize; i++) {
-    blockData[i] = resultPtr[2+i];
+    blockData[i] = resultPtr[1+i];
 #ifdef DEBUG    
     PN5180DEBUG(formatHex(blockData[i]));
     PN5180DEBUG(" ");
@@ -269,6 +595,7 @@ ISO15693ErrorCode PN5180ISO15693::readSingleBlock(uint8_t *uid, uint8_t blockNo,
   PN5180DEBUG("\n");
 #endif
 
+  if (tagCache) tagCache->store(uid, 8, blockNo, blockData, blockSize);
   return ISO15693_EC_OK;
 }
 
@@ -276,6 +603,9 @@ ISO15693ErrorCode PN5180ISO15693::readSingleBlock(uint8_t *uid, uint8_t blockNo,
  * Write single block, code=21
  *
  * Request format: SOF, Requ.Flags, WriteSingleBlock, UID (opt.), BlockNumber, BlockData (len=blcokLength), CRC16, EOF
+ *
+ * Block numbers above 255 use Extended write single block, code=31, with a
+ * 2 byte BlockNumber (LSB first).
  * Response format:
  *  when ERROR flag is set:
  *    SOF, Resp.Flags, ErrorCode, CRC16, EOF
@@ -300,23 +630,17 @@ ISO15693ErrorCode PN5180ISO15693::readSingleBlock(uint8_t *uid, uint8_t blockNo,
  *  when ERROR flag is NOT set:
  *    SOF, Resp.Flags, CRC16, EOF
  */
-ISO15693ErrorCode PN5180ISO15693::writeSingleBlock(uint8_t *uid, uint8_t blockNo, uint8_t *blockData, uint8_t blockSize) {
-  //                            flags, cmd, uid,             blockNo
-  uint8_t writeSingleBlock[] = { 0x22, 0x21, 1,2,3,4,5,6,7,8, blockNo }; // UID has LSB first!
-  //                               |\- high data rate
-  //                               \-- no options, addressed by UID
-
-  uint8_t writeCmdSize = sizeof(writeSingleBlock) + blockSize;
-  uint8_t *writeCmd = (uint8_t*)malloc(writeCmdSize);
-  uint8_t pos = 0;
-  writeCmd[pos++] = writeSingleBlock[0];
-  writeCmd[pos++] = writeSingleBlock[1];
-  for (int i=0; i<8; i++) {
-    writeCmd[pos++] = uid[i];
+ISO15693ErrorCode PN5180ISO15693::writeSingleBlock(uint8_t *uid, uint16_t blockNo, uint8_t *blockData, uint8_t blockSize) {
+  if (blockSize > ISO15693_MAX_BLOCK_SIZE) {
+    return ISO15693_EC_OPTION_NOT_SUPPORTED;
   }
-  writeCmd[pos++] = blockNo;
+  //          flags, cmd, uid (opt.), blockNo, blockData
+  bool extended = (blockNo > 255);
+  uint8_t pos = buildHeader(extended ? 0x31 : 0x21, uid);
+  frame[pos++] = blockNo & 0xff;
+  if (extended) frame[pos++] = blockNo >> 8;
   for (int i=0; i<blockSize; i++) {
-    writeCmd[pos++] = blockData[i];
+    frame[pos++] = blockData[i];
   }
 
 #ifdef DEBUG
@@ -325,28 +649,108 @@ ISO15693ErrorCode PN5180ISO15693::writeSingleBlock(uint8_t *uid, uint8_t blockNo
   PN5180DEBUG(", size=");
   PN5180DEBUG(blockSize);
   PN5180DEBUG(":");
-  for (int i=0; i<writeCmdSize; i++) {
+  for (int i=0; i<pos; i++) {
     PN5180DEBUG(" ");
-    PN5180DEBUG(formatHex(writeCmd[i]));
+    PN5180DEBUG(formatHex(frame[i]));
   }
   PN5180DEBUG("\n");
 #endif
 
+  if (tagCache) tagCache->invalidate(uid, 8, blockNo);
+
   uint8_t *resultPtr;
-  ISO15693ErrorCode rc = issueISO15693Command(writeCmd, writeCmdSize, &resultPtr);
+  ISO15693ErrorCode rc = issueISO15693Command(frame, pos, &resultPtr, 1);
   if (ISO15693_EC_OK != rc) {
-    free(writeCmd);
     return rc;
   }
 
-  free(writeCmd);
+  if (tagCache) tagCache->store(uid, 8, blockNo, blockData, blockSize);
   return ISO15693_EC_OK;
 }
 
+/*
+ * Write multiple blocks, code=24
+ *
+ * Request format: SOF, Req.Flags, WriteMultipleBlocks, UID (opt.), FirstBlockNumber, numBlocks-1, BlockData (len=numBlocks*blockSize), CRC16, EOF
+ * Response format: as Write single block
+ *
+ * Requests which reach beyond block 255 use Extended write multiple blocks,
+ * code=34, with 2 byte FirstBlockNumber and numBlocks-1 (LSB first).
+ *
+ * Writes numBlocks blocks from blockData in requests of upto
+ * ISO15693_WRITE_MULTIPLE_MAX_BLOCKS blocks. Tags which do not support
+ * WRITE MULTIPLE BLOCKS are written with back to back WRITE SINGLE BLOCK
+ * requests. The throughput is reported in getWriteStats().
+ */
+ISO15693ErrorCode PN5180ISO15693::writeMultipleBlocks(uint8_t *uid, uint16_t firstBlock, uint16_t numBlocks, uint8_t *blockData, uint8_t blockSize) {
+  if ((blockSize == 0) || (blockSize > ISO15693_MAX_BLOCK_SIZE)) {
+    return ISO15693_EC_OPTION_NOT_SUPPORTED;
+  }
+  if ((numBlocks == 0) || ((uint32_t)firstBlock + numBlocks > 65536)) {
+    return ISO15693_EC_BLOCK_NOT_AVAILABLE;
+  }
+  unsigned long startedUs = micros();
+  uint8_t maxChunk = ISO15693_WRITE_MULTIPLE_MAX_BLOCKS;
+  if (maxChunk * blockSize > ISO15693_MAX_WRITE_DATA) maxChunk = ISO15693_MAX_WRITE_DATA / blockSize;
+  if (maxChunk == 0) maxChunk = 1;
+
+  ISO15693ErrorCode rc = ISO15693_EC_OK;
+  ISO15693SystemInfo *info = findSystemInfo(uid);
+  bool multiple = (maxChunk > 1) && (!info || (info->features & ISO15693_FEATURE_WRITE_MULTIPLE));
+  uint16_t done = 0;
+  while (done < numBlocks) {
+    uint16_t blockNo = firstBlock + done;
+    uint8_t *data = &blockData[done * blockSize];
+    if (!multiple || (numBlocks - done == 1)) {
+      rc = writeSingleBlock(uid, blockNo, data, blockSize);
+      if (ISO15693_EC_OK != rc) break;
+      writeStats.singleWrites++;
+      done++;
+      continue;
+    }
+
+    uint8_t chunk = (numBlocks - done < maxChunk) ? numBlocks - done : maxChunk;
+    //          flags, cmd, uid (opt.), 1stBlock, blocks-1, blockData
+    bool extended = (blockNo + chunk > 256);
+    uint8_t pos = buildHeader(extended ? 0x34 : 0x24, uid);
+    frame[pos++] = blockNo & 0xff;
+    if (extended) frame[pos++] = blockNo >> 8;
+    frame[pos++] = chunk - 1;
+    if (extended) frame[pos++] = 0;
+    for (int i=0; i<chunk * blockSize; i++) {
+      frame[pos++] = data[i];
+    }
+    for (int i=0; i<chunk; i++) {
+      if (tagCache) tagCache->invalidate(uid, 8, blockNo + i);
+    }
+
+    uint8_t *resultPtr;
+    rc = issueISO15693Command(frame, pos, &resultPtr, 1);
+    if ((ISO15693_EC_NOT_SUPPORTED == rc) || (ISO15693_EC_NOT_RECOGNIZED == rc) || (ISO15693_EC_OPTION_NOT_SUPPORTED == rc)) {
+      PN5180DEBUG("writeMultipleBlocks: no WRITE MULTIPLE BLOCKS, writing single blocks\n");
+      clearFeature(uid, ISO15693_FEATURE_WRITE_MULTIPLE);
+      multiple = false;
+      continue;
+    }
+    if (ISO15693_EC_OK != rc) break;
+    for (int i=0; i<chunk; i++) {
+      if (tagCache) tagCache->store(uid, 8, blockNo + i, &data[i * blockSize], blockSize);
+    }
+    writeStats.multipleWrites++;
+    done += chunk;
+  }
+  writeStats.bytes += (uint32_t)done * blockSize;
+  writeStats.durationUs += micros() - startedUs;
+  return rc;
+}
+
 /*
  * Read multiple block, code=23
  *
  * Request format: SOF, Req.Flags, ReadMultipleBlock, UID (opt.), FirstBlockNumber, numBlocks, CRC16, EOF
+ *
+ * Requests which reach beyond block 255 use Extended read multiple blocks,
+ * code=33, with 2 byte FirstBlockNumber and numBlocks-1 (LSB first).
  * Response format:
  *  when ERROR flag is set:
  *    SOF, Resp.Flags, ErrorCode, CRC16, EOF
@@ -371,44 +775,14 @@ ISO15693ErrorCode PN5180ISO15693::writeSingleBlock(uint8_t *uid, uint8_t blockNo
  *  when ERROR flag is NOT set:
  *    SOF, Flags, BlockData (len=blockSize * numBlock), CRC16, EOF
  */
-ISO15693ErrorCode PN5180ISO15693::readMultipleBlock(uint8_t *uid, uint8_t blockNo, uint8_t numBlock, uint8_t *blockData, uint8_t blockSize) {
-  if(blockNo > numBlock-1){ // Attempted to start at a block greater than the num blocks on the VICC
-    PN5180DEBUG("Starting block exceeds length of data");
-    return ISO15693_EC_BLOCK_NOT_AVAILABLE;
-  }
-  if( (blockNo + numBlock) > numBlock ){ // Will attempt to read a block greater than the num blocks on the VICC 
-    PN5180DEBUG("End of block exceeds length of data");
-    return ISO15693_EC_BLOCK_NOT_AVAILABLE;
-  }
-
-  //                              flags, cmd, uid,             1stBlock blocksToRead  
-  uint8_t readMultipleCmd[12] = { 0x22, 0x23, 1,2,3,4,5,6,7,8, blockNo, numBlock-1 }; // UID has LSB first!
-  //                                |\- high data rate
-  //                                \-- no options, addressed by UID
-
-  for (int i=0; i<8; i++) {
-    readMultipleCmd[2+i] = uid[i];
-  }
-
-  PN5180DEBUG("readMultipleBlock: Read Block #");
-  PN5180DEBUG(blockNo);
-  PN5180DEBUG("-");
-  PN5180DEBUG(blockNo+numBlock-1);
-  PN5180DEBUG(", blockSize=");
-  PN5180DEBUG(blockSize);
-  PN5180DEBUG(", Cmd: ");
-  for (int i=0; i<sizeof(readMultipleCmd); i++) {
-    PN5180DEBUG(" ");
-    PN5180DEBUG(formatHex(readMultipleCmd[i]));
-  }
-
+ISO15693ErrorCode PN5180ISO15693::readMultipleBlock(uint8_t *uid, uint16_t blockNo, uint16_t numBlock, uint8_t *blockData, uint8_t blockSize) {
   uint8_t *resultPtr;
-  ISO15693ErrorCode rc = issueISO15693Command(readMultipleCmd, sizeof(readMultipleCmd), &resultPtr);
+  ISO15693ErrorCode rc = readMultipleBlockRaw(uid, blockNo, numBlock, blockSize, &resultPtr);
   if (ISO15693_EC_OK != rc) return rc;
 
   PN5180DEBUG("readMultipleBlock: Value=");
   for (int i=0; i<numBlock * blockSize; i++) {
-    blockData[i] = resultPtr[1+i];
+    blockData[i] = resultPtr[i];
 #ifdef DEBUG    
     PN5180DEBUG(formatHex(blockData[i]));
     PN5180DEBUG(" ");
@@ -430,6 +804,154 @@ ISO15693ErrorCode PN5180ISO15693::readMultipleBlock(uint8_t *uid, uint8_t blockN
   return ISO15693_EC_OK;
 }
 
+/*
+ * Issue READ MULTIPLE BLOCKS and return a pointer to the block data in the
+ * reception buffer, valid until the next command.
+ * The response (flags + numBlock * blockSize) has to fit the RX buffer.
+ */
+ISO15693ErrorCode PN5180ISO15693::readMultipleBlockRaw(uint8_t *uid, uint16_t blockNo, uint16_t numBlock, uint8_t blockSize, uint8_t **data) {
+  if ((numBlock == 0) || ((uint32_t)blockNo + numBlock > 65536)) {
+    PN5180DEBUG("readMultipleBlock: Block range exceeds 16 bit block numbers\n");
+    return ISO15693_EC_BLOCK_NOT_AVAILABLE;
+  }
+  if (1 + (uint32_t)numBlock * blockSize > PN5180_RX_BUFFER_SIZE) {
+    PN5180DEBUG("readMultipleBlock: Response exceeds the RX buffer\n");
+    return ISO15693_EC_OPTION_NOT_SUPPORTED;
+  }
+
+  //          flags, cmd, uid (opt.), 1stBlock, blocksToRead
+  bool extended = ((uint32_t)blockNo + numBlock > 256);
+  uint8_t pos = buildHeader(extended ? 0x33 : 0x23, uid);
+  frame[pos++] = blockNo & 0xff;
+  if (extended) frame[pos++] = blockNo >> 8;
+  frame[pos++] = (numBlock - 1) & 0xff;
+  if (extended) frame[pos++] = (numBlock - 1) >> 8;
+
+  PN5180DEBUG("readMultipleBlock: Read Block #");
+  PN5180DEBUG(blockNo);
+  PN5180DEBUG("-");
+  PN5180DEBUG(blockNo+numBlock-1);
+  PN5180DEBUG(", blockSize=");
+  PN5180DEBUG(blockSize);
+  PN5180DEBUG(", Cmd: ");
+  for (int i=0; i<pos; i++) {
+    PN5180DEBUG(" ");
+    PN5180DEBUG(formatHex(frame[i]));
+  }
+
+  uint8_t *resultPtr;
+  ISO15693ErrorCode rc = issueISO15693Command(frame, pos, &resultPtr, 1 + numBlock * blockSize);
+  if (ISO15693_EC_OK != rc) return rc;
+  *data = &resultPtr[1];
+  return ISO15693_EC_OK;
+}
+
+/*
+ * Block size and number of blocks from the cached system information
+ */
+ISO15693ErrorCode PN5180ISO15693::getMemoryGeometry(uint8_t *uid, uint8_t *blockSize, uint16_t *numBlocks) {
+  ISO15693SystemInfo info;
+  ISO15693ErrorCode rc = getCachedSystemInfo(uid, &info);
+  if (ISO15693_EC_OK != rc) return rc;
+  if (info.blockSize == 0) return ISO15693_EC_NOT_SUPPORTED; // no memory size in the system info
+  *blockSize = info.blockSize;
+  *numBlocks = info.numBlocks;
+  return ISO15693_EC_OK;
+}
+
+/*
+ * Read count blocks starting at firstBlock and pass them to sink in chunks.
+ * The geometry is taken from the system information cache, count=0 reads up to the
+ * end of the memory. Each chunk is the largest READ MULTIPLE BLOCKS which
+ * fits the RX buffer, halved while the tag rejects it; tags without READ
+ * MULTIPLE BLOCKS are read block by block. The data passed to sink is only
+ * valid during the call, sink returns false to stop reading.
+ */
+ISO15693ErrorCode PN5180ISO15693::readMemory(uint8_t *uid, uint16_t firstBlock, uint16_t count, ISO15693MemorySink sink, void *context) {
+  uint8_t blockSize;
+  uint16_t numBlocks;
+  ISO15693ErrorCode rc = getMemoryGeometry(uid, &blockSize, &numBlocks);
+  if (ISO15693_EC_OK != rc) return rc;
+  if (count == 0) count = (firstBlock < numBlocks) ? numBlocks - firstBlock : 0;
+  if ((count == 0) || ((uint32_t)firstBlock + count > numBlocks)) {
+    return ISO15693_EC_BLOCK_NOT_AVAILABLE;
+  }
+
+  uint16_t maxChunk = (PN5180_RX_BUFFER_SIZE - 1) / blockSize;
+  ISO15693SystemInfo *info = findSystemInfo(uid);
+  bool multiple = !info || (info->features & ISO15693_FEATURE_READ_MULTIPLE);
+  uint8_t blockData[32];
+  uint16_t blockNo = firstBlock;
+  uint16_t remaining = count;
+  while (remaining > 0) {
+    uint8_t *data;
+    uint16_t chunk = (remaining < maxChunk) ? remaining : maxChunk;
+    if (multiple) {
+      rc = readMultipleBlockRaw(uid, blockNo, chunk, blockSize, &data);
+      if ((ISO15693_EC_NOT_SUPPORTED == rc) || (ISO15693_EC_NOT_RECOGNIZED == rc)) {
+        PN5180DEBUG("readMemory: no READ MULTIPLE BLOCKS, reading single blocks\n");
+        clearFeature(uid, ISO15693_FEATURE_READ_MULTIPLE);
+        multiple = false;
+        continue;
+      }
+      // tags may limit the number of blocks of one request
+      if (((ISO15693_EC_OPTION_NOT_SUPPORTED == rc) || (ISO15693_EC_BLOCK_NOT_AVAILABLE == rc)) && (chunk > 1)) {
+        maxChunk = chunk / 2;
+        PN5180DEBUG("readMemory: chunk rejected, retrying with ");
+        PN5180DEBUG(maxChunk);
+        PN5180DEBUG(" blocks\n");
+        continue;
+      }
+    }
+    else {
+      chunk = 1;
+      data = blockData;
+      rc = readSingleBlock(uid, blockNo, blockData, blockSize);
+    }
+    if (ISO15693_EC_OK != rc) return rc;
+    if (!sink(blockNo, data, chunk, blockSize, context)) break;
+    blockNo += chunk;
+    remaining -= chunk;
+  }
+  return ISO15693_EC_OK;
+}
+
+/*
+ * Write count blocks starting at firstBlock, source fills the data of each
+ * block and returns false to stop writing. The geometry is taken from the
+ * system information cache, count=0 writes up to the end of the memory.
+ */
+ISO15693ErrorCode PN5180ISO15693::writeMemory(uint8_t *uid, uint16_t firstBlock, uint16_t count, ISO15693MemorySource source, void *context) {
+  uint8_t blockSize;
+  uint16_t numBlocks;
+  ISO15693ErrorCode rc = getMemoryGeometry(uid, &blockSize, &numBlocks);
+  if (ISO15693_EC_OK != rc) return rc;
+  if (count == 0) count = (firstBlock < numBlocks) ? numBlocks - firstBlock : 0;
+  if ((count == 0) || ((uint32_t)firstBlock + count > numBlocks)) {
+    return ISO15693_EC_BLOCK_NOT_AVAILABLE;
+  }
+
+  // collect the blocks of one WRITE MULTIPLE BLOCKS request
+  uint8_t blockData[ISO15693_MAX_WRITE_DATA];
+  uint8_t maxChunk = ISO15693_MAX_WRITE_DATA / blockSize;
+  uint16_t blockNo = firstBlock;
+  bool more = true;
+  while (more && (blockNo < firstBlock + count)) {
+    uint8_t chunk = 0;
+    while ((chunk < maxChunk) && (blockNo + chunk < firstBlock + count)) {
+      if (!source(blockNo + chunk, &blockData[chunk * blockSize], blockSize, context)) {
+        more = false;
+        break;
+      }
+      chunk++;
+    }
+    if (chunk == 0) break;
+    rc = writeMultipleBlocks(uid, blockNo, chunk, blockData, blockSize);
+    if (ISO15693_EC_OK != rc) return rc;
+    blockNo += chunk;
+  }
+  return ISO15693_EC_OK;
+}
 
 /*
  * Get System Information, code=2B
@@ -477,30 +999,30 @@ ISO15693ErrorCode PN5180ISO15693::readMultipleBlock(uint8_t *uid, uint8_t blockN
  *
  *    IC reference: The IC reference is on 8 bits and its meaning is defined by the IC manufacturer.
  */
-ISO15693ErrorCode PN5180ISO15693::getSystemInfo(uint8_t *uid, uint8_t *blockSize, uint8_t *numBlocks) {
-  uint8_t sysInfo[] = { 0x22, 0x2b, 1,2,3,4,5,6,7,8 };  // UID has LSB first!
-  for (int i=0; i<8; i++) {
-    sysInfo[2+i] = uid[i];
-  }
+ISO15693ErrorCode PN5180ISO15693::getSystemInfo(uint8_t *uid, ISO15693SystemInfo *info) {
+  uint8_t pos = buildHeader(0x2b, uid);
 
 #ifdef DEBUG
   PN5180DEBUG("Get System Information");
-  for (int i=0; i<sizeof(sysInfo); i++) {
+  for (int i=0; i<pos; i++) {
     PN5180DEBUG(" ");
-    PN5180DEBUG(formatHex(sysInfo[i]));
+    PN5180DEBUG(formatHex(frame[i]));
   }
   PN5180DEBUG("\n");
 #endif
 
   uint8_t *readBuffer;
-  ISO15693ErrorCode rc = issueISO15693Command(sysInfo, sizeof(sysInfo), &readBuffer);
+  ISO15693ErrorCode rc = issueISO15693Command(frame, pos, &readBuffer, 15);
   if (ISO15693_EC_OK != rc) {
     return rc;
   }
 
+  memset(info, 0, sizeof(ISO15693SystemInfo));
   for (int i=0; i<8; i++) {
     uid[i] = readBuffer[2+i];
+    info->uid[i] = readBuffer[2+i];
   }
+  info->features = ISO15693_FEATURE_READ_MULTIPLE | ISO15693_FEATURE_WRITE_MULTIPLE;
   
 #ifdef DEBUG
   PN5180DEBUG("UID=");
@@ -514,17 +1036,20 @@ ISO15693ErrorCode PN5180ISO15693::getSystemInfo(uint8_t *uid, uint8_t *blockSize
   uint8_t *p = &readBuffer[10];
 
   uint8_t infoFlags = readBuffer[1];
-  if (infoFlags & 0x01) { // DSFID flag
+  info->infoFlags = infoFlags & 0x0f;
+  if (infoFlags & ISO15693_INFO_DSFID) { // DSFID flag
+    info->dsfid = *p++;
     PN5180DEBUG("DSFID=");  // Data storage format identifier
-    PN5180DEBUG(formatHex(uint8_t(*p++)));
+    PN5180DEBUG(formatHex(info->dsfid));
     PN5180DEBUG("\n");
   }
 #ifdef DEBUG
   else PN5180DEBUG(F("No DSFID\n"));  
 #endif
   
-  if (infoFlags & 0x02) { // AFI flag
+  if (infoFlags & ISO15693_INFO_AFI) { // AFI flag
     uint8_t afi = *p++;
+    info->afi = afi;
     PN5180DEBUG(F("AFI="));  // Application family identifier
     PN5180DEBUG(formatHex(afi));
     PN5180DEBUG(F(" - "));
@@ -550,29 +1075,30 @@ ISO15693ErrorCode PN5180ISO15693::getSystemInfo(uint8_t *uid, uint8_t *blockSize
   else PN5180DEBUG(F("No AFI\n"));
 #endif
 
-  if (infoFlags & 0x04) { // VICC Memory size
-    *numBlocks = *p++;
-    *blockSize = *p++;
-    *blockSize = (*blockSize) & 0x1f;
+  if (infoFlags & ISO15693_INFO_MEMSIZE) { // VICC Memory size
+    info->numBlocks = *p++;
+    info->blockSize = *p++;
+    info->blockSize = info->blockSize & 0x1f;
 
-    *blockSize = *blockSize + 1; // range: 1-32
-    *numBlocks = *numBlocks + 1; // range: 1-256
+    info->blockSize = info->blockSize + 1; // range: 1-32
+    info->numBlocks = info->numBlocks + 1; // range: 1-256
 
     PN5180DEBUG("VICC MemSize=");
-    PN5180DEBUG(uint16_t(*blockSize) * (*numBlocks));
+    PN5180DEBUG(uint16_t(info->blockSize) * info->numBlocks);
     PN5180DEBUG(" BlockSize=");
-    PN5180DEBUG(*blockSize);
+    PN5180DEBUG(info->blockSize);
     PN5180DEBUG(" NumBlocks=");
-    PN5180DEBUG(*numBlocks);
+    PN5180DEBUG(info->numBlocks);
     PN5180DEBUG("\n");
   }
 #ifdef DEBUG
   else PN5180DEBUG(F("No VICC memory size\n"));
 #endif
    
-  if (infoFlags & 0x08) { // IC reference
+  if (infoFlags & ISO15693_INFO_ICREF) { // IC reference
+    info->icRef = *p++;
     PN5180DEBUG("IC Ref=");
-    PN5180DEBUG(formatHex(uint8_t(*p++)));
+    PN5180DEBUG(formatHex(info->icRef));
     PN5180DEBUG("\n");
   }
 #ifdef DEBUG
@@ -582,6 +1108,137 @@ ISO15693ErrorCode PN5180ISO15693::getSystemInfo(uint8_t *uid, uint8_t *blockSize
   return ISO15693_EC_OK;
 }
 
+/*
+ * Extended get system information, code=3B
+ *
+ * Request format: SOF, Req.Flags, ExtGetSysInfo, InfoRequest, UID (opt.), CRC16, EOF
+ * Response format:
+ *  when ERROR flag is NOT set:
+ *    SOF, Flags, InfoFlags, UID, DSFID (opt.), AFI (opt.), Other fields (opt.), CRC16, EOF
+ *
+ *    InfoRequest and InfoFlags as for Get system information, the extended
+ *    VICC memory size has a 2 byte number of blocks:
+ *      nnnn.nnnn nnnn.nnnn xxxb.bbbb
+ *        n - Number of blocks - 1, LSB first, upto 65536 blocks
+ *        b - Block size - 1
+ *
+ * Only the fields of Get system information are requested. Numbers of
+ * blocks above 65535 are reported as 65535.
+ */
+ISO15693ErrorCode PN5180ISO15693::getExtendedSystemInfo(uint8_t *uid, ISO15693SystemInfo *info) {
+  // the InfoRequest byte comes before the UID
+  uint8_t pos = buildHeader(0x3b, uid, 0,
+                            ISO15693_INFO_DSFID | ISO15693_INFO_AFI | ISO15693_INFO_MEMSIZE | ISO15693_INFO_ICREF);
+
+  uint8_t *readBuffer;
+  ISO15693ErrorCode rc = issueISO15693Command(frame, pos, &readBuffer, 16);
+  if (ISO15693_EC_OK != rc) {
+    return rc;
+  }
+
+  memset(info, 0, sizeof(ISO15693SystemInfo));
+  for (int i=0; i<8; i++) {
+    uid[i] = readBuffer[2+i];
+    info->uid[i] = readBuffer[2+i];
+  }
+  info->features = ISO15693_FEATURE_READ_MULTIPLE | ISO15693_FEATURE_WRITE_MULTIPLE;
+  uint8_t *p = &readBuffer[10];
+  uint8_t infoFlags = readBuffer[1];
+  info->infoFlags = infoFlags & 0x0f;
+  if (infoFlags & ISO15693_INFO_DSFID) info->dsfid = *p++;
+  if (infoFlags & ISO15693_INFO_AFI) info->afi = *p++;
+  if (infoFlags & ISO15693_INFO_MEMSIZE) {
+    uint32_t blocks = (uint32_t)(p[0] | (p[1] << 8)) + 1;
+    info->numBlocks = (blocks > 0xffff) ? 0xffff : blocks;
+    info->blockSize = (p[2] & 0x1f) + 1;
+    p += 3;
+  }
+  if (infoFlags & ISO15693_INFO_ICREF) info->icRef = *p++;
+
+  PN5180DEBUG(F("Extended system info: BlockSize="));
+  PN5180DEBUG(info->blockSize);
+  PN5180DEBUG(F(" NumBlocks="));
+  PN5180DEBUG(info->numBlocks);
+  PN5180DEBUG("\n");
+  return ISO15693_EC_OK;
+}
+
+/*
+ * Block size and number of blocks only, 256 blocks are reported as 0.
+ * Both are 0 if the tag does not report its memory size.
+ */
+ISO15693ErrorCode PN5180ISO15693::getSystemInfo(uint8_t *uid, uint8_t *blockSize, uint8_t *numBlocks) {
+  ISO15693SystemInfo info;
+  ISO15693ErrorCode rc = getSystemInfo(uid, &info);
+  if (ISO15693_EC_OK != rc) return rc;
+  *blockSize = info.blockSize;
+  *numBlocks = (uint8_t)info.numBlocks;
+  return ISO15693_EC_OK;
+}
+
+/*
+ * System information of the tag with this UID, GET SYSTEM INFORMATION is
+ * only sent if the tag is not in the cache yet. The cache keeps the
+ * ISO15693_SYSTEM_INFO_CACHE_SIZE most recently used tags and the commands
+ * a tag rejected, it is kept over field resets since the information is
+ * fixed per tag.
+ * Tags which report no memory size or the maximum of 256 blocks are asked
+ * with EXTENDED GET SYSTEM INFORMATION for memories beyond block 255.
+ */
+ISO15693ErrorCode PN5180ISO15693::getCachedSystemInfo(uint8_t *uid, ISO15693SystemInfo *info) {
+  ISO15693SystemInfo *entry = findSystemInfo(uid);
+  if (entry) {
+    *info = *entry;
+    return ISO15693_EC_OK;
+  }
+  uint8_t uidCopy[8];
+  memcpy(uidCopy, uid, 8);
+  ISO15693ErrorCode rc = getSystemInfo(uidCopy, info);
+  if (ISO15693_EC_OK != rc) return rc;
+  if ((info->blockSize == 0) || (info->numBlocks == 256)) {
+    ISO15693SystemInfo extended;
+    if (ISO15693_EC_OK == getExtendedSystemInfo(uidCopy, &extended)) {
+      *info = extended;
+    }
+  }
+  memcpy(info->uid, uid, 8);
+  // insert as most recently used, evict the least recently used
+  if (systemInfoCount < ISO15693_SYSTEM_INFO_CACHE_SIZE) systemInfoCount++;
+  for (int i=systemInfoCount-1; i>0; i--) {
+    systemInfoCache[i] = systemInfoCache[i-1];
+  }
+  systemInfoCache[0] = *info;
+  return ISO15693_EC_OK;
+}
+
+void PN5180ISO15693::clearSystemInfoCache() {
+  systemInfoCount = 0;
+}
+
+/*
+ * Cache entry of this UID, moved to the front as most recently used.
+ * Returns 0L if the tag is not cached.
+ */
+ISO15693SystemInfo *PN5180ISO15693::findSystemInfo(uint8_t *uid) {
+  if (!uid) return 0L;
+  for (int i=0; i<systemInfoCount; i++) {
+    if (0 == memcmp(systemInfoCache[i].uid, uid, 8)) {
+      ISO15693SystemInfo entry = systemInfoCache[i];
+      for (int j=i; j>0; j--) {
+        systemInfoCache[j] = systemInfoCache[j-1];
+      }
+      systemInfoCache[0] = entry;
+      return &systemInfoCache[0];
+    }
+  }
+  return 0L;
+}
+
+void PN5180ISO15693::clearFeature(uint8_t *uid, uint8_t feature) {
+  ISO15693SystemInfo *entry = findSystemInfo(uid);
+  if (entry) entry->features &= ~feature;
+}
+
 
 // ICODE SLIX specific commands
 
@@ -590,10 +1247,10 @@ ISO15693ErrorCode PN5180ISO15693::getSystemInfo(uint8_t *uid, uint8_t *blockSize
  * The passwords that will be transmitted with the SET PASSWORD,ENABLEPRIVACY and DESTROY commands 
  * have to be calculated with the password and the random number (see Section 9.5.3.2 "SET PASSWORD")
  */
-ISO15693ErrorCode PN5180ISO15693::getRandomNumber(uint8_t *randomData) {
-  uint8_t getrandom[] = {0x02, 0xB2, 0x04};
+ISO15693ErrorCode PN5180ISO15693::getRandomNumber(uint8_t *randomData, uint8_t *uid) {
+  uint8_t pos = buildHeader(0xB2, uid, 0, ISO15693_MFG_NXP);
   uint8_t *readBuffer;
-  ISO15693ErrorCode rc = issueISO15693Command(getrandom, sizeof(getrandom), &readBuffer);
+  ISO15693ErrorCode rc = issueISO15693Command(frame, pos, &readBuffer, 3);
   if (rc == ISO15693_EC_OK) {
     randomData[0] = readBuffer[1];
     randomData[1] = readBuffer[2];
@@ -606,15 +1263,15 @@ ISO15693ErrorCode PN5180ISO15693::getRandomNumber(uint8_t *randomData) {
  * to access the different protected functionalities of the following commands. 
  * The SET PASSWORD command has to be executed just once for the related passwords if the label is powered
  */
-ISO15693ErrorCode PN5180ISO15693::setPassword(uint8_t identifier, uint8_t *password, uint8_t *random) {
-  uint8_t setPassword[] = {0x02, 0xB3, 0x04, 0x04, 0x00, 0x00, 0x00, 0x00};
+ISO15693ErrorCode PN5180ISO15693::setPassword(uint8_t identifier, uint8_t *password, uint8_t *random, uint8_t *uid) {
+  uint8_t pos = buildHeader(0xB3, uid, 0, ISO15693_MFG_NXP);
+  frame[pos++] = identifier;
+  frame[pos++] = password[0] ^ random[0];
+  frame[pos++] = password[1] ^ random[1];
+  frame[pos++] = password[2] ^ random[0];
+  frame[pos++] = password[3] ^ random[1];
   uint8_t *readBuffer;
-  setPassword[3] = identifier;
-  setPassword[4] = password[0] ^ random[0];
-  setPassword[5] = password[1] ^ random[1];
-  setPassword[6] = password[2] ^ random[0];
-  setPassword[7] = password[3] ^ random[1];
-  ISO15693ErrorCode rc = issueISO15693Command(setPassword, sizeof(setPassword), &readBuffer);
+  ISO15693ErrorCode rc = issueISO15693Command(frame, pos, &readBuffer, 1);
   return rc;
 }
 
@@ -623,20 +1280,27 @@ ISO15693ErrorCode PN5180ISO15693::setPassword(uint8_t identifier, uint8_t *passw
  * Privacy mode if the Privacy password is correct. The ICODE SLIX2 will not respond to
  * any command except GET RANDOM NUMBER and SET PASSWORD
  */
-ISO15693ErrorCode PN5180ISO15693::enablePrivacy(uint8_t *password, uint8_t *random) {
-  uint8_t setPrivacy[] = {0x02, 0xBA, 0x04, 0x00, 0x00, 0x00, 0x00};
+ISO15693ErrorCode PN5180ISO15693::enablePrivacy(uint8_t *password, uint8_t *random, uint8_t *uid) {
+  uint8_t pos = buildHeader(0xBA, uid, 0, ISO15693_MFG_NXP);
+  frame[pos++] = password[0] ^ random[0];
+  frame[pos++] = password[1] ^ random[1];
+  frame[pos++] = password[2] ^ random[0];
+  frame[pos++] = password[3] ^ random[1];
   uint8_t *readBuffer;
-  setPrivacy[3] = password[0] ^ random[0];
-  setPrivacy[4] = password[1] ^ random[1];
-  setPrivacy[5] = password[2] ^ random[0];
-  setPrivacy[6] = password[3] ^ random[1];
-  ISO15693ErrorCode rc = issueISO15693Command(setPrivacy, sizeof(setPrivacy), &readBuffer);
+  ISO15693ErrorCode rc = issueISO15693Command(frame, pos, &readBuffer, 1);
+  if ((ISO15693_EC_OK == rc) && uid) {
+    // privacy mode again, the password has to be set again
+    ISO15693SecurityEntry *entry = findSecurityEntry(uid, false);
+    if (entry) entry->unlocked = 0;
+  }
   return rc;
 }
 
 
 // disable privacy mode for ICODE SLIX2 tag with given password
-ISO15693ErrorCode PN5180ISO15693::disablePrivacyMode(uint8_t *password) {
+ISO15693ErrorCode PN5180ISO15693::disablePrivacyMode(uint8_t *password, uint8_t *uid) {
+  if (uid) return setTagPassword(uid, 0x04, password);
+
   // get a random number from the tag
   uint8_t random[]= {0x00, 0x00};
   ISO15693ErrorCode rc = getRandomNumber(random);
@@ -650,19 +1314,278 @@ ISO15693ErrorCode PN5180ISO15693::disablePrivacyMode(uint8_t *password) {
 }
 
 // enable privacy mode for ICODE SLIX2 tag with given password 
-ISO15693ErrorCode PN5180ISO15693::enablePrivacyMode(uint8_t *password) {
-  // get a random number from the tag
+ISO15693ErrorCode PN5180ISO15693::enablePrivacyMode(uint8_t *password, uint8_t *uid) {
+  // get a random number from the tag, reused within the session if addressed
   uint8_t random[]= {0x00, 0x00};
-  ISO15693ErrorCode rc = getRandomNumber(random);
-  if (rc != ISO15693_EC_OK) {
-    return rc;
+  ISO15693SecurityEntry *entry = uid ? findSecurityEntry(uid, true) : 0L;
+  if (entry && entry->hasRandom) {
+    memcpy(random, entry->random, 2);
+  }
+  else {
+    ISO15693ErrorCode rc = getRandomNumber(random, uid);
+    if (rc != ISO15693_EC_OK) {
+      return rc;
+    }
+    if (entry) {
+      memcpy(entry->random, random, 2);
+      entry->hasRandom = true;
+    }
   }
   
   // enable privacy command to lock the tag
-  rc = enablePrivacy(password, random);
-  return rc; 
+  return enablePrivacy(password, random, uid);
+}
+
+/*
+ * Addressed SET PASSWORD within the security session of the RF field.
+ * A tag keeps its random number and the accepted passwords as long as it
+ * is powered, so GET RANDOM NUMBER is sent once per tag and SET PASSWORD
+ * is skipped for a password which the tag already accepted.
+ * A failed SET PASSWORD drops the random number, the next call fetches a
+ * new one. The session of a tag ends when the field is switched off, an
+ * addressed request gets no answer or a complete inventory misses it.
+ */
+ISO15693ErrorCode PN5180ISO15693::setTagPassword(uint8_t *uid, uint8_t identifier, uint8_t *password) {
+  uint8_t bit = identifierBit(identifier);
+  if (0 == bit) return ISO15693_EC_OPTION_NOT_SUPPORTED;
+  ISO15693SecurityEntry *entry = findSecurityEntry(uid, true);
+  if (entry->unlocked & bit) {
+    PN5180DEBUG(F("setTagPassword: already set\n"));
+    return ISO15693_EC_OK;
+  }
+  if (!entry->hasRandom) {
+    ISO15693ErrorCode rc = getRandomNumber(entry->random, uid);
+    if (ISO15693_EC_OK != rc) return rc;
+    entry->hasRandom = true;
+  }
+  ISO15693ErrorCode rc = setPassword(identifier, password, entry->random, uid);
+  if (ISO15693_EC_OK != rc) {
+    entry->hasRandom = false;
+    return rc;
+  }
+  entry->unlocked |= bit;
+  return ISO15693_EC_OK;
+}
+
+/*
+ * Disable the privacy mode of numTags SLIX2 tags in one pass, each with its
+ * own password. Tags which are already unlocked in this RF session are
+ * skipped. results (optional) receives the error code of each tag.
+ * Returns the number of unlocked tags.
+ */
+uint8_t PN5180ISO15693::unlockPrivacy(ISO15693Credential *tags, uint8_t numTags, ISO15693ErrorCode *results) {
+  uint8_t unlocked = 0;
+  for (int i=0; i<numTags; i++) {
+    ISO15693ErrorCode rc = setTagPassword(tags[i].uid, 0x04, tags[i].password);
+    if (results) results[i] = rc;
+    if (ISO15693_EC_OK == rc) unlocked++;
+#ifdef DEBUG
+    else {
+      PN5180DEBUG(F("unlockPrivacy: tag "));
+      PN5180DEBUG(i);
+      PN5180DEBUG(F(" failed, "));
+      PN5180DEBUG(strerror(rc));
+      PN5180DEBUG("\n");
+    }
+#endif
+  }
+  return unlocked;
+}
+
+bool PN5180ISO15693::isUnlocked(uint8_t *uid, uint8_t identifier) {
+  ISO15693SecurityEntry *entry = findSecurityEntry(uid, false);
+  return entry && (entry->unlocked & identifierBit(identifier));
+}
+
+/*
+ * Forget all random numbers and passwords, tags lose them when the RF
+ * field is switched off. Called by setupRF(), and by findSecurityEntry()
+ * once the field was switched off in any other way.
+ */
+void PN5180ISO15693::endSecuritySession() {
+  securityCount = 0;
+  securityRFOffCount = getRFOffCount();
+}
+
+/*
+ * Session entry of this UID. With create, a new entry is added, or the
+ * oldest one is reused if the session is full.
+ */
+ISO15693SecurityEntry *PN5180ISO15693::findSecurityEntry(uint8_t *uid, bool create) {
+  if (securityRFOffCount != getRFOffCount()) endSecuritySession();
+  for (int i=0; i<securityCount; i++) {
+    if (0 == memcmp(securitySession[i].uid, uid, 8)) return &securitySession[i];
+  }
+  if (!create) return 0L;
+  if (securityCount == ISO15693_SECURITY_SESSION_SIZE) {
+    for (int i=1; i<securityCount; i++) {
+      securitySession[i-1] = securitySession[i];
+    }
+    securityCount--;
+  }
+  ISO15693SecurityEntry *entry = &securitySession[securityCount++];
+  memcpy(entry->uid, uid, 8);
+  entry->hasRandom = false;
+  entry->unlocked = 0;
+  return entry;
+}
+
+/*
+ * The tag left the field, or was switched off: when it returns it is
+ * locked again and has a new random number
+ */
+void PN5180ISO15693::dropSecurityEntry(uint8_t *uid) {
+  for (int i=0; i<securityCount; i++) {
+    if (0 == memcmp(securitySession[i].uid, uid, 8)) {
+      for (int j=i+1; j<securityCount; j++) {
+        securitySession[j-1] = securitySession[j];
+      }
+      securityCount--;
+      return;
+    }
+  }
+}
+
+/*
+ * After a complete inventory: drop the session of every tag within the
+ * inventory filter which did not answer
+ */
+void PN5180ISO15693::dropMissingSecurityEntries(uint8_t *uid, uint8_t numCard) {
+  uint64_t filterMask = (inventoryFilter.maskLen < 64) ? ((uint64_t)1 << inventoryFilter.maskLen) - 1 : ~(uint64_t)0;
+  int i = 0;
+  while (i < securityCount) {
+    uint64_t tagUid = 0;
+    for (int b=7; b>=0; b--) tagUid = (tagUid << 8) | securitySession[i].uid[b];
+    if (((tagUid & filterMask) == inventoryFilter.mask) && !isKnownUID(uid, numCard, securitySession[i].uid)) {
+      dropSecurityEntry(securitySession[i].uid);
+    }
+    else i++;
+  }
+}
+
+/*
+ * An addressed request got no answer
+ */
+ISO15693ErrorCode PN5180ISO15693::tagLost(uint8_t *uid) {
+  if (0L != uid) dropSecurityEntry(uid);
+  return EC_NO_CARD;
+}
+
+/*
+ * SLIX2 password identifiers: 0x01 read, 0x02 write, 0x04 privacy,
+ * 0x08 destroy, 0x10 EAS/AFI
+ */
+uint8_t PN5180ISO15693::identifierBit(uint8_t identifier) {
+  switch (identifier) {
+    case 0x01: case 0x02: case 0x04: case 0x08: case 0x10:
+      return identifier;
+    default:
+      return 0;
+  }
+}
+
+
+/*
+ * Start a request in the frame buffer: request flags, command code and the
+ * UID if needed. Returns the number of bytes written.
+ *   uid == selected UID: select flag, no UID (8 bytes shorter)
+ *   uid != 0L:           address flag, UID
+ *   uid == 0L:           not addressed, executed by every tag in Ready state
+ * option: additional request flags, e.g. the option flag 0x40
+ * preUid: parameter byte between command and UID, e.g. the IC Mfg code of
+ *         custom commands, -1 for none
+ */
+uint8_t PN5180ISO15693::buildHeader(uint8_t command, uint8_t *uid, uint8_t option, int16_t preUid) {
+  uint8_t pos = 0;
+  uint8_t flags = requestFlags | option; // data rate of the RF profile
+  addressedUID = uid;
+  if ((0L != uid) && isSelected(uid)) {
+    flags |= 0x10; // select flag
+    uid = 0L;
+  }
+  else if (0L != uid) {
+    flags |= 0x20; // address flag
+  }
+  frame[pos++] = flags;
+  frame[pos++] = command;
+  if (preUid >= 0) {
+    frame[pos++] = (uint8_t)preUid;
+  }
+  if (0L != uid) {
+    for (int i=0; i<8; i++) {
+      frame[pos++] = uid[i]; // UID has LSB first!
+    }
+  }
+  return pos;
 }
 
+bool PN5180ISO15693::isSelected(uint8_t *uid) {
+  return tagSelected && (0 == memcmp(uid, selectedUID, 8));
+}
+
+/*
+ * Select, code=25
+ *
+ * Request format: SOF, Req.Flags, Select, UID, CRC16, EOF
+ * Response format: SOF, Resp.Flags, CRC16, EOF
+ *
+ * The tag enters the Selected state, commands for it are then sent in
+ * selected mode without the UID until another tag is selected or
+ * resetToReady() is called. Other selected tags return to Ready.
+ */
+ISO15693ErrorCode PN5180ISO15693::selectTag(uint8_t *uid) {
+  tagSelected = false;
+  uint8_t pos = buildHeader(0x25, uid);
+  uint8_t *readBuffer;
+  ISO15693ErrorCode rc = issueISO15693Command(frame, pos, &readBuffer, 1);
+  if (ISO15693_EC_OK != rc) return rc;
+  memcpy(selectedUID, uid, 8);
+  tagSelected = true;
+  return ISO15693_EC_OK;
+}
+
+/*
+ * Stay quiet, code=02
+ *
+ * Request format: SOF, Req.Flags, StayQuiet, UID, CRC16, EOF
+ * No response.
+ *
+ * The tag enters the Quiet state and no longer answers inventories until
+ * resetToReady() or a reset of the RF field (resetField()).
+ */
+ISO15693ErrorCode PN5180ISO15693::stayQuiet(uint8_t *uid) {
+  if (isSelected(uid)) tagSelected = false;
+  // STAY QUIET is always addressed
+  uint8_t pos = 0;
+  frame[pos++] = 0x20 | requestFlags;
+  frame[pos++] = 0x02;
+  for (int i=0; i<8; i++) {
+    frame[pos++] = uid[i];
+  }
+  clearIRQStatus(TX_IRQ_STAT);
+  if (!sendData(frame, pos)) return ISO15693_EC_UNKNOWN_ERROR;
+  uint32_t txTimeout = (uint32_t)pos * ISO15693_BYTE_TIME_US + ISO15693_FRAME_OVERHEAD_US + ISO15693_TIMEOUT_MARGIN_US;
+  if (0 == (waitForIRQ(TX_IRQ_STAT, txTimeout) & TX_IRQ_STAT)) return ISO15693_EC_UNKNOWN_ERROR;
+  return ISO15693_EC_OK;
+}
+
+/*
+ * Reset to ready, code=26
+ *
+ * Request format: SOF, Req.Flags, ResetToReady, UID (opt.), CRC16, EOF
+ * Response format: SOF, Resp.Flags, CRC16, EOF
+ *
+ * The tag returns from Quiet or Selected to Ready. uid=0L resets all tags
+ * in the field, the responses of several tags collide and are not checked.
+ */
+ISO15693ErrorCode PN5180ISO15693::resetToReady(uint8_t *uid) {
+  uint8_t pos = buildHeader(0x26, uid);
+  if ((0L == uid) || isSelected(uid)) tagSelected = false;
+  uint8_t *readBuffer;
+  ISO15693ErrorCode rc = issueISO15693Command(frame, pos, &readBuffer, 1);
+  if ((0L == uid) && (EC_NO_CARD != rc)) return ISO15693_EC_OK;
+  return rc;
+}
 
 /*
  * ISO 15693 - Protocol
@@ -713,45 +1636,60 @@ ISO15693ErrorCode PN5180ISO15693::enablePrivacyMode(uint8_t *password) {
  *    14 = The specific block was not successfully locked.
  *    A0-DF = Custom command error codes
  *
+ *  expectedLen: length of the response without CRC, used for the
+ *  reception deadline. 0 if unknown, the reception then ends after
+ *  commandTimeout ms.
+ *
  *  Function return values:
  *    0 = OK
  *   -1 = No card detected
  *   >0 = Error code
  */
-ISO15693ErrorCode PN5180ISO15693::issueISO15693Command(uint8_t *cmd, uint8_t cmdLen, uint8_t **resultPtr) {
+ISO15693ErrorCode PN5180ISO15693::issueISO15693Command(uint8_t *cmd, uint8_t cmdLen, uint8_t **resultPtr, uint16_t expectedLen) {
 #ifdef DEBUG
   PN5180DEBUG(F("Issue Command 0x"));
   PN5180DEBUG(formatHex(cmd[1]));
   PN5180DEBUG("...\n");
 #endif
 
+  // a frame without buildHeader() is not addressed
+  uint8_t *uid = addressedUID;
+  addressedUID = 0L;
+  // flags of an earlier error response or timeout must not be taken as
+  // the SOF/RX of this one
+  clearIRQStatus(0x000FFFFF);
+  unsigned long startedUs = micros();
   sendData(cmd, cmdLen);
-  delay(10);
 
-  uint32_t irqR = getIRQStatus();
+  uint32_t irqR;
+  if (legacyDelay) {
+    delay(10);
+    irqR = getIRQStatus();
+  }
+  else {
+    // the SOF is expected t1 after the end of the request
+    uint32_t sofTimeout = (uint32_t)cmdLen * ISO15693_BYTE_TIME_US + ISO15693_T1_US
+                        + ISO15693_FRAME_OVERHEAD_US + ISO15693_TIMEOUT_MARGIN_US;
+    sofTimeout += writeTimeUs(cmd);
+    irqR = waitForIRQ(RX_SOF_DET_IRQ_STAT | RX_IRQ_STAT, sofTimeout);
+  }
   if (0 == (irqR & RX_SOF_DET_IRQ_STAT)) {
 	PN5180DEBUG("Didnt detect RX_SOF_DET_IRQ_STAT after sendData");
-	return EC_NO_CARD;
+	return tagLost(uid);
   }
-  
-  // The following line prevents code from continuing until the RX_IRQ_STAT flag 
-  // is set in the IRQ_STATUS register, which signifies the end of RF reception
-  // But, should the card be removed from the reader quickly before reception is complete,
-  // this bit will never be received and the code will hang at this point.
-  // TODO implement a reasonable timeout in which to expect the bit to be read, as in https://github.com/playfultechnology/PN5180-Library/blob/e64468d65906c207bdaf900a1645615c71f3d5ca/PN5180.cpp#L489-L494
-  /*
-  while(!(irqR & RX_IRQ_STAT)) {
-	delay(1);
-	irqR = getIRQStatus();
-  }
-  */
-  unsigned long startedWaiting = millis();
-  while (!(irqR & RX_IRQ_STAT)) {
-      irqR = getIRQStatus();
-      if (millis() - startedWaiting > commandTimeout) {
-          PN5180DEBUG("Didnt detect RX_IRQ_STAT after sendData");
-          return EC_NO_CARD;
-      }
+
+  // wait for the end of the reception, the card may be removed during it
+  if (!(irqR & RX_IRQ_STAT)) {
+    uint32_t rxTimeout = (uint32_t)commandTimeout * 1000;
+    if (!legacyDelay && (expectedLen > 0)) {
+      uint16_t byteTime = (cmd[0] & 0x02) ? ISO15693_BYTE_TIME_US : ISO15693_LOW_RATE_BYTE_TIME_US;
+      rxTimeout = (uint32_t)expectedLen * byteTime + ISO15693_FRAME_OVERHEAD_US + ISO15693_TIMEOUT_MARGIN_US;
+    }
+    irqR = waitForIRQ(RX_IRQ_STAT, rxTimeout);
+    if (!(irqR & RX_IRQ_STAT)) {
+      PN5180DEBUG("Didnt detect RX_IRQ_STAT after sendData");
+      return tagLost(uid);
+    }
   }
   
   uint32_t rxStatus;
@@ -771,6 +1709,13 @@ ISO15693ErrorCode PN5180ISO15693::issueISO15693Command(uint8_t *cmd, uint8_t cmd
     PN5180DEBUG(F("*** ERROR in readData!\n"));
     return ISO15693_EC_UNKNOWN_ERROR;
   }
+
+  uint32_t latencyUs = micros() - startedUs;
+  commandStats.lastUs = latencyUs;
+  if ((commandStats.count == 0) || (latencyUs < commandStats.minUs)) commandStats.minUs = latencyUs;
+  if (latencyUs > commandStats.maxUs) commandStats.maxUs = latencyUs;
+  commandStats.totalUs += latencyUs;
+  commandStats.count++;
   
 #ifdef DEBUG
   Serial.print("Read=");
@@ -785,7 +1730,7 @@ ISO15693ErrorCode PN5180ISO15693::issueISO15693Command(uint8_t *cmd, uint8_t cmd
   if (0 == (RX_SOF_DET_IRQ_STAT & irqStatus)) { // no card detected
      PN5180DEBUG("Didnt detect RX_SOF_DET_IRQ_STAT after readData");
      clearIRQStatus(TX_IRQ_STAT | IDLE_IRQ_STAT);
-     return EC_NO_CARD;
+     return tagLost(uid);
   }
 
   uint8_t responseFlags = (*resultPtr)[0];
@@ -798,6 +1743,7 @@ ISO15693ErrorCode PN5180ISO15693::issueISO15693Command(uint8_t *cmd, uint8_t cmd
     PN5180DEBUG(strerror((ISO15693ErrorCode)errorCode));
     PN5180DEBUG("\n");
 
+    clearIRQStatus(RX_SOF_DET_IRQ_STAT | IDLE_IRQ_STAT | TX_IRQ_STAT | RX_IRQ_STAT);
     if (errorCode >= 0xA0) { // custom command error codes
       return ISO15693_EC_CUSTOM_CMD_ERROR;
     }
@@ -816,7 +1762,7 @@ ISO15693ErrorCode PN5180ISO15693::issueISO15693Command(uint8_t *cmd, uint8_t cmd
 
 bool PN5180ISO15693::setupRF() {
   PN5180DEBUG(F("Loading RF-Configuration...\n"));
-  if (loadRFConfig(0x0d, 0x8d)) {  // ISO15693 parameters
+  if (loadRFConfig(rfProfiles[rfProfile].txConf, rfProfiles[rfProfile].rxConf)) {  // ISO15693 parameters
     PN5180DEBUG(F("done.\n"));
   }
   else return false;
@@ -830,9 +1776,149 @@ bool PN5180ISO15693::setupRF() {
   writeRegisterWithAndMask(SYSTEM_CONFIG, 0xfffffff8);  // Idle/StopCom Command
   writeRegisterWithOrMask(SYSTEM_CONFIG, 0x00000003);   // Transceive Command
 
+  endSecuritySession();
+  return true;
+}
+
+/*
+ * Write and lock commands answer after the EEPROM is programmed, WRITE
+ * MULTIPLE BLOCKS programs each block
+ */
+uint32_t PN5180ISO15693::writeTimeUs(uint8_t *cmd) {
+  switch (cmd[1]) {
+    case 0x21: // WRITE SINGLE BLOCK
+    case 0x22: // LOCK BLOCK
+    case 0x27: // WRITE AFI
+    case 0x28: // LOCK AFI
+    case 0x29: // WRITE DSFID
+    case 0x2A: // LOCK DSFID
+      return ISO15693_WRITE_TIME_US;
+    case 0x24: // WRITE MULTIPLE BLOCKS, number of blocks after the first block number
+      return ISO15693_WRITE_TIME_US * (1 + ((cmd[0] & 0x20) ? cmd[11] : cmd[3]));
+    case 0x31: // EXTENDED WRITE SINGLE BLOCK
+    case 0x32: // EXTENDED LOCK BLOCK
+      return ISO15693_WRITE_TIME_US;
+    case 0x34: // EXTENDED WRITE MULTIPLE BLOCKS, 2 byte block number and count
+      return ISO15693_WRITE_TIME_US * (1 + ((cmd[0] & 0x20) ? (cmd[12] | (cmd[13] << 8)) : (cmd[4] | (cmd[5] << 8))));
+    default:
+      return 0;
+  }
+}
+
+/*
+ * Wait a fixed 10ms for the response as in earlier versions instead of the
+ * SOF/RX IRQ with a deadline derived from the request and response length.
+ * Used to compare the command latency of both with getCommandStats().
+ */
+void PN5180ISO15693::setLegacyDelay(bool enable) {
+  legacyDelay = enable;
+}
+
+/*
+ * Latency of successful commands from sendData until the response is read
+ */
+const ISO15693CommandStats &PN5180ISO15693::getCommandStats() {
+  return commandStats;
+}
+
+/*
+ * Bytes written with writeMultipleBlocks() and the time it took
+ */
+const ISO15693WriteStats &PN5180ISO15693::getWriteStats() {
+  return writeStats;
+}
+
+uint32_t PN5180ISO15693::getWriteThroughput() {
+  if (writeStats.durationUs == 0) return 0;
+  return (uint32_t)((uint64_t)writeStats.bytes * 1000000 / writeStats.durationUs);
+}
+
+void PN5180ISO15693::resetWriteStats() {
+  writeStats = ISO15693WriteStats();
+}
+
+void PN5180ISO15693::resetCommandStats() {
+  commandStats.count = 0;
+  commandStats.lastUs = 0;
+  commandStats.minUs = 0;
+  commandStats.maxUs = 0;
+  commandStats.totalUs = 0;
+}
+
+/*
+ * Select the modulation (ASK100 or ASK10) and whether the custom FAST
+ * commands are answered at 53 kbit/s. The TX/RX configuration is loaded
+ * right away, the request flags of all commands follow the profile.
+ */
+bool PN5180ISO15693::setRFProfile(ISO15693RFProfile profile) {
+  if (profile >= ISO15693_PROFILE_COUNT) return false;
+  rfProfile = profile;
+  return loadRFConfig(rfProfiles[profile].txConf, rfProfiles[profile].rxConf);
+}
+
+ISO15693RFProfile PN5180ISO15693::getRFProfile() {
+  return rfProfile;
+}
+
+/*
+ * Measure a RF profile with an ICODE tag in the field: rounds INVENTORY
+ * READs of block 0 of uid, masked to the 48 UID bits below the Mfg code so
+ * only that tag answers. Every profile times the same exchange, the FAST
+ * profiles send it as FAST INVENTORY READ.
+ * Profile, inventory filter, population estimate and inventory statistics
+ * are restored afterwards, the block cache is bypassed.
+ * Compare bytesPerSecond and errors of all profiles to choose the fastest
+ * reliable one for an installation.
+ */
+bool PN5180ISO15693::benchmarkRFProfile(ISO15693RFProfile profile, uint8_t *uid, uint8_t blockSize,
+                                        uint16_t rounds, ISO15693ProfileResult *result) {
+  if ((blockSize == 0) || (blockSize > ISO15693_MAX_BLOCK_SIZE)) return false;
+  ISO15693RFProfile previous = rfProfile;
+  *result = ISO15693ProfileResult();
+  if (!setRFProfile(profile)) return false;
+  PN5180TagCache *cache = tagCache;
+  tagCache = 0L;
+  ISO15693InventoryFilter filter = inventoryFilter;
+  ISO15693InventoryStats stats = inventoryStats;
+  float estimate = populationEstimate;
+  inventoryFilter.useAfi = false;
+  setInventoryMask(uid, 48);
+
+  uint8_t blockData[ISO15693_MAX_BLOCK_SIZE];
+  uint8_t foundUid[8];
+  for (uint16_t i=0; i<rounds; i++) {
+    uint8_t numCard = 0;
+    // a single slot round, the mask leaves one tag
+    populationEstimate = 1.0;
+    unsigned long startedUs = micros();
+    ISO15693ErrorCode rc = getInventoryRead(foundUid, 1, &numCard, 0, 1, blockSize, blockData,
+                                            rfProfiles[profile].fast);
+    result->durationUs += micros() - startedUs;
+    if ((ISO15693_EC_OK == rc) && (numCard == 0)) rc = EC_NO_CARD;
+    result->commands++;
+    if (ISO15693_EC_OK == rc) result->bytes += blockSize;
+    else result->errors++;
+  }
+  if (result->durationUs > 0) {
+    result->bytesPerSecond = (uint32_t)((uint64_t)result->bytes * 1000000 / result->durationUs);
+  }
+
+  inventoryFilter = filter;
+  inventoryStats = stats;
+  populationEstimate = estimate;
+  tagCache = cache;
+  setRFProfile(previous);
   return true;
 }
 
+/*
+ * Attach a cache for blocks read with readSingleBlock, keyed by UID.
+ * Pass 0L to detach the cache.
+ */
+void PN5180ISO15693::setTagCache(PN5180TagCache *cache) {
+  tagCache = cache;
+}
+
 const __FlashStringHelper *PN5180ISO15693::strerror(ISO15693ErrorCode errno) {
   PN5180DEBUG(F("ISO15693ErrorCode="));
   PN5180DEBUG(errno);
@@ -840,6 +1926,7 @@ const __FlashStringHelper *PN5180ISO15693::strerror(ISO15693ErrorCode errno) {
   
   switch (errno) {
     case EC_NO_CARD: return F("No card detected!");
+    case EC_INVENTORY_INCOMPLETE: return F("Inventory incomplete, collision stack too small!");
     case ISO15693_EC_OK: return F("OK!");
     case ISO15693_EC_NOT_SUPPORTED: return F("Command is not supported!");
     case ISO15693_EC_NOT_RECOGNIZED: return F("Command is not recognized!");
@@ -20,9 +20,11 @@
 #define PN5180ISO15693_H
 
 #include "PN5180.h"
+#include "PN5180TagCache.h"
 
 enum ISO15693ErrorCode {
   EC_NO_CARD = -1,
+  EC_INVENTORY_INCOMPLETE = -2, // collided slots were dropped, tags may be missing
   ISO15693_EC_OK = 0,
   ISO15693_EC_NOT_SUPPORTED = 0x01,
   ISO15693_EC_NOT_RECOGNIZED = 0x02,
@@ -36,34 +38,260 @@ enum ISO15693ErrorCode {
   ISO15693_EC_CUSTOM_CMD_ERROR = 0xA0
 };
 
+// Latency of ISO15693 commands in microseconds
+struct ISO15693CommandStats {
+  uint32_t count;
+  uint32_t lastUs;
+  uint32_t minUs;
+  uint32_t maxUs;
+  uint32_t totalUs;
+};
+
+#define ISO15693_MAX_BLOCK_SIZE 32
+// largest block data of one write request, sizes the frame buffer
+#ifndef ISO15693_MAX_WRITE_DATA
+#define ISO15693_MAX_WRITE_DATA 128
+#endif
+// many tags limit WRITE MULTIPLE BLOCKS to 4 blocks
+#ifndef ISO15693_WRITE_MULTIPLE_MAX_BLOCKS
+#define ISO15693_WRITE_MULTIPLE_MAX_BLOCKS 4
+#endif
+// flags, command, UID, 2 byte block number, 2 byte number of blocks, data
+#define ISO15693_FRAME_SIZE (2 + 8 + 2 + 2 + ISO15693_MAX_WRITE_DATA)
+
+// tags an inventory is expected to resolve with the built-in collision stack
+#ifndef ISO15693_INVENTORY_MAX_TAGS
+#define ISO15693_INVENTORY_MAX_TAGS 16
+#endif
+// every pushed mask is a collided slot of at least 2 tags, plus the 16 masks
+// of the first round of a dense inventory. More tags need a larger stack
+// from setCollisionStack().
+#ifndef ISO15693_COLLISION_STACK_SIZE
+#define ISO15693_COLLISION_STACK_SIZE (16 + ISO15693_INVENTORY_MAX_TAGS / 2)
+#endif
+
+// UID prefix (LSB first) of tags still to be resolved by an inventory round
+struct ISO15693InventoryMask {
+  uint64_t mask;
+  uint8_t length; // in bits, 0-64
+};
+
+// Slot statistics of an ISO15693 inventory
+struct ISO15693InventoryStats {
+  uint16_t rounds;
+  uint16_t slots;
+  uint16_t emptySlots;
+  uint16_t singleSlots;
+  uint16_t collisionSlots;
+  uint16_t firstRoundSingles;
+  uint16_t firstRoundCollisions;
+  uint16_t duplicates;   // UIDs which were already found
+  uint16_t droppedMasks; // collided slots which did not fit the stack
+  uint32_t durationUs;
+};
+
+// Command and data range of the rounds of an inventory
+struct ISO15693InventoryOptions {
+  uint8_t command;    // 0x01 INVENTORY, 0xA0 INVENTORY READ, 0xA1 FAST INVENTORY READ
+  uint8_t firstBlock;
+  uint8_t numBlocks;  // 0 for INVENTORY
+  uint8_t blockSize;
+  uint8_t *blockData;
+};
+
+// TX modulation and response data rate of the custom FAST commands
+enum ISO15693RFProfile {
+  ISO15693_PROFILE_ASK100 = 0, // TX 0x0D, RX 0x8D (26 kbit/s), default
+  ISO15693_PROFILE_ASK10,      // TX 0x0E, RX 0x8D
+  ISO15693_PROFILE_ASK100_FAST,// as ASK100, FAST INVENTORY READ with RX 0x8E (53 kbit/s)
+  ISO15693_PROFILE_ASK10_FAST, // as ASK10, FAST INVENTORY READ with RX 0x8E
+  ISO15693_PROFILE_COUNT
+};
+
+// Result of benchmarkRFProfile()
+struct ISO15693ProfileResult {
+  uint16_t commands;
+  uint16_t errors;
+  uint32_t bytes;
+  uint32_t durationUs;
+  uint32_t bytesPerSecond;
+};
+
+#ifndef ISO15693_SYSTEM_INFO_CACHE_SIZE
+#define ISO15693_SYSTEM_INFO_CACHE_SIZE 4
+#endif
+// infoFlags of GET SYSTEM INFORMATION, field present in the response
+#define ISO15693_INFO_DSFID   (0x01)
+#define ISO15693_INFO_AFI     (0x02)
+#define ISO15693_INFO_MEMSIZE (0x04)
+#define ISO15693_INFO_ICREF   (0x08)
+// features, cleared when the tag rejected the command
+#define ISO15693_FEATURE_READ_MULTIPLE  (0x01)
+#define ISO15693_FEATURE_WRITE_MULTIPLE (0x02)
+
+// Parsed GET SYSTEM INFORMATION of one tag
+struct ISO15693SystemInfo {
+  uint8_t uid[8];
+  uint8_t infoFlags;
+  uint8_t dsfid;
+  uint8_t afi;
+  uint8_t blockSize;  // 1-32, 0 if not reported
+  uint16_t numBlocks; // 1-65535, 0 if not reported
+  uint8_t icRef;
+  uint8_t features;
+};
+
+#ifndef ISO15693_SECURITY_SESSION_SIZE
+#define ISO15693_SECURITY_SESSION_SIZE 8
+#endif
+
+// UID and privacy password of a SLIX2 tag for unlockPrivacy()
+struct ISO15693Credential {
+  uint8_t uid[8];
+  uint8_t password[4];
+};
+
+// Random number and accepted passwords of one tag in the RF session
+struct ISO15693SecurityEntry {
+  uint8_t uid[8];
+  uint8_t random[2];
+  bool hasRandom;
+  uint8_t unlocked; // identifiers of the accepted passwords
+};
+
+// Only tags with this AFI and UID prefix answer an inventory
+struct ISO15693InventoryFilter {
+  bool useAfi;
+  uint8_t afi;
+  uint64_t mask;   // UID prefix, LSB first
+  uint8_t maskLen; // in bits, 0-64
+};
+
+// Throughput of writeMultipleBlocks()
+struct ISO15693WriteStats {
+  uint32_t bytes;
+  uint32_t durationUs;
+  uint16_t multipleWrites; // WRITE MULTIPLE BLOCKS requests
+  uint16_t singleWrites;   // WRITE SINGLE BLOCK requests
+};
+
+// Receives a chunk of numBlocks blocks starting at firstBlock from
+// readMemory(), returns false to stop reading
+typedef bool (*ISO15693MemorySink)(uint16_t firstBlock, uint8_t *data, uint16_t numBlocks, uint8_t blockSize, void *context);
+// Fills the data of one block for writeMemory(), returns false to stop writing
+typedef bool (*ISO15693MemorySource)(uint16_t blockNo, uint8_t *data, uint8_t blockSize, void *context);
+
 class PN5180ISO15693 : public PN5180 {
 
 public:
   PN5180ISO15693(uint8_t SSpin, uint8_t BUSYpin, uint8_t RSTpin, SPIClass& spi=SPI);
   
 private:
-  ISO15693ErrorCode issueISO15693Command(uint8_t *cmd, uint8_t cmdLen, uint8_t **resultPtr);
-  ISO15693ErrorCode inventoryPoll(uint8_t *uid, uint8_t maxTags, uint8_t *numCard, uint8_t *numCol, uint16_t *collision);
+  ISO15693ErrorCode issueISO15693Command(uint8_t *cmd, uint8_t cmdLen, uint8_t **resultPtr, uint16_t expectedLen = 0);
+  uint32_t writeTimeUs(uint8_t *cmd);
+  uint8_t frame[ISO15693_FRAME_SIZE];
+  uint8_t buildHeader(uint8_t command, uint8_t *uid, uint8_t option = 0, int16_t preUid = -1);
+  ISO15693RFProfile rfProfile = ISO15693_PROFILE_ASK100;
+  // PN5180 RX configs are for the high data rate with one subcarrier only
+  uint8_t requestFlags = 0x02;
+  bool isSelected(uint8_t *uid);
+  bool tagSelected = false;
+  uint8_t selectedUID[8];
+  ISO15693WriteStats writeStats = {};
+  bool legacyDelay = false;
+  ISO15693CommandStats commandStats = {};
+  ISO15693ErrorCode inventoryPoll(uint8_t *uid, uint8_t maxTags, uint8_t *numCard, uint64_t mask, uint8_t maskLen, uint8_t numSlots);
+  ISO15693InventoryMask defaultCollisionStack[ISO15693_COLLISION_STACK_SIZE];
+  ISO15693InventoryMask *collisionStack = defaultCollisionStack;
+  uint16_t collisionStackSize = ISO15693_COLLISION_STACK_SIZE;
+  uint16_t collisionDepth = 0;
+  void pushCollision(uint64_t mask, uint8_t length);
+  ISO15693InventoryOptions inventoryOptions = {};
+  ISO15693InventoryFilter inventoryFilter = {};
+  ISO15693ErrorCode runInventory(uint8_t *uid, uint8_t maxTags, uint8_t *numCard);
+  bool isKnownUID(uint8_t *uid, uint8_t numCard, uint8_t *candidate);
+  ISO15693ErrorCode readMultipleBlockRaw(uint8_t *uid, uint16_t blockNo, uint16_t numBlock, uint8_t blockSize, uint8_t **data);
+  ISO15693ErrorCode getMemoryGeometry(uint8_t *uid, uint8_t *blockSize, uint16_t *numBlocks);
+  float populationEstimate = 1.0;
+  ISO15693InventoryStats inventoryStats = {};
+  void updatePopulationEstimate(uint8_t numCard, uint8_t maxTags);
+  PN5180TagCache *tagCache = 0L;
+  ISO15693SystemInfo systemInfoCache[ISO15693_SYSTEM_INFO_CACHE_SIZE];
+  uint8_t systemInfoCount = 0;
+  ISO15693SystemInfo *findSystemInfo(uint8_t *uid);
+  void clearFeature(uint8_t *uid, uint8_t feature);
+  ISO15693SecurityEntry securitySession[ISO15693_SECURITY_SESSION_SIZE];
+  uint8_t securityCount = 0;
+  uint16_t securityRFOffCount = 0;
+  ISO15693SecurityEntry *findSecurityEntry(uint8_t *uid, bool create);
+  void dropSecurityEntry(uint8_t *uid);
+  void dropMissingSecurityEntries(uint8_t *uid, uint8_t numCard);
+  uint8_t *addressedUID = 0L; // UID of the request in the frame buffer
+  ISO15693ErrorCode tagLost(uint8_t *uid);
+  uint8_t identifierBit(uint8_t identifier);
 public:
   ISO15693ErrorCode getInventory(uint8_t *uid);
   ISO15693ErrorCode getInventoryMultiple(uint8_t *uid, uint8_t maxTags, uint8_t *numCard);
-  ISO15693ErrorCode readSingleBlock(uint8_t *uid, uint8_t blockNo, uint8_t *blockData, uint8_t blockSize);
-  ISO15693ErrorCode writeSingleBlock(uint8_t *uid, uint8_t blockNo, uint8_t *blockData, uint8_t blockSize);
-  ISO15693ErrorCode readMultipleBlock(uint8_t *uid, uint8_t blockNo, uint8_t numBlock, uint8_t *blockData, uint8_t blockSize);
+  void setInventoryAFI(uint8_t afi);
+  void setInventoryMask(const uint8_t *uidPrefix, uint8_t maskLen);
+  void clearInventoryFilter();
+  float getPopulationEstimate();
+  void setPopulationEstimate(float estimate);
+  const ISO15693InventoryStats &getInventoryStats();
+  void setCollisionStack(ISO15693InventoryMask *stack, uint16_t size);
+  // ICODE INVENTORY READ
+  ISO15693ErrorCode getInventoryRead(uint8_t *uid, uint8_t maxTags, uint8_t *numCard,
+                                     uint8_t firstBlock, uint8_t numBlocks, uint8_t blockSize,
+                                     uint8_t *blockData, bool fast = false);
+  // block numbers above 255 use the extended commands
+  ISO15693ErrorCode readSingleBlock(uint8_t *uid, uint16_t blockNo, uint8_t *blockData, uint8_t blockSize);
+  ISO15693ErrorCode writeSingleBlock(uint8_t *uid, uint16_t blockNo, uint8_t *blockData, uint8_t blockSize);
+  ISO15693ErrorCode readMultipleBlock(uint8_t *uid, uint16_t blockNo, uint16_t numBlock, uint8_t *blockData, uint8_t blockSize);
+  ISO15693ErrorCode writeMultipleBlocks(uint8_t *uid, uint16_t firstBlock, uint16_t numBlocks, uint8_t *blockData, uint8_t blockSize);
   ISO15693ErrorCode getSystemInfo(uint8_t *uid, uint8_t *blockSize, uint8_t *numBlocks);
+  ISO15693ErrorCode getSystemInfo(uint8_t *uid, ISO15693SystemInfo *info);
+  ISO15693ErrorCode getExtendedSystemInfo(uint8_t *uid, ISO15693SystemInfo *info);
+  // system information from the cache, one exchange per tag
+  ISO15693ErrorCode getCachedSystemInfo(uint8_t *uid, ISO15693SystemInfo *info);
+  void clearSystemInfoCache();
+  // session modes
+  ISO15693ErrorCode selectTag(uint8_t *uid);
+  ISO15693ErrorCode stayQuiet(uint8_t *uid);
+  ISO15693ErrorCode resetToReady(uint8_t *uid = 0L);
+  // whole memory access in chunks, geometry from getSystemInfo
+  ISO15693ErrorCode readMemory(uint8_t *uid, uint16_t firstBlock, uint16_t count, ISO15693MemorySink sink, void *context = 0L);
+  ISO15693ErrorCode writeMemory(uint8_t *uid, uint16_t firstBlock, uint16_t count, ISO15693MemorySource source, void *context = 0L);
    
   // ICODE SLIX2 specific commands, see https://www.nxp.com/docs/en/data-sheet/SL2S2602.pdf
-  ISO15693ErrorCode getRandomNumber(uint8_t *randomData);
-  ISO15693ErrorCode setPassword(uint8_t identifier, uint8_t *password, uint8_t *random);
-  ISO15693ErrorCode enablePrivacy(uint8_t *password, uint8_t *random);
+  // uid=0L sends the commands not addressed, to every tag in the field
+  ISO15693ErrorCode getRandomNumber(uint8_t *randomData, uint8_t *uid = 0L);
+  ISO15693ErrorCode setPassword(uint8_t identifier, uint8_t *password, uint8_t *random, uint8_t *uid = 0L);
+  ISO15693ErrorCode enablePrivacy(uint8_t *password, uint8_t *random, uint8_t *uid = 0L);
   // helpers
-  ISO15693ErrorCode enablePrivacyMode(uint8_t *password);
-  ISO15693ErrorCode disablePrivacyMode(uint8_t *password);
+  ISO15693ErrorCode enablePrivacyMode(uint8_t *password, uint8_t *uid = 0L);
+  ISO15693ErrorCode disablePrivacyMode(uint8_t *password, uint8_t *uid = 0L);
+  // addressed security session, valid until the RF field is switched off
+  ISO15693ErrorCode setTagPassword(uint8_t *uid, uint8_t identifier, uint8_t *password);
+  uint8_t unlockPrivacy(ISO15693Credential *tags, uint8_t numTags, ISO15693ErrorCode *results = 0L);
+  bool isUnlocked(uint8_t *uid, uint8_t identifier = 0x04);
+  void endSecuritySession();
   /*
    * Helper functions
    */
 public:   
   bool setupRF();
+  bool resetField();
+  bool setRFProfile(ISO15693RFProfile profile);
+  ISO15693RFProfile getRFProfile();
+  bool benchmarkRFProfile(ISO15693RFProfile profile, uint8_t *uid, uint8_t blockSize,
+                          uint16_t rounds, ISO15693ProfileResult *result);
+  void setTagCache(PN5180TagCache *cache);
+  void setLegacyDelay(bool enable);
+  const ISO15693CommandStats &getCommandStats();
+  void resetCommandStats();
+  const ISO15693WriteStats &getWriteStats();
+  uint32_t getWriteThroughput();
+  void resetWriteStats();
   const __FlashStringHelper *strerror(ISO15693ErrorCode errno);
     
 };
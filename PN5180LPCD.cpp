@@ -0,0 +1,247 @@
+// NAME: PN5180LPCD.cpp
+//
+// DESC: Adaptive low power card detection (LPCD) for the PN5180 library.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// #define DEBUG 1
+
+#include <Arduino.h>
+#include "PN5180LPCD.h"
+#include "Debug.h"
+
+PN5180LPCD::PN5180LPCD(PN5180 &reader, uint16_t targetLatencyMs) : reader(reader) {
+  maxFalseWakeRate = 0.1;
+  fieldOn = 0xF0;
+  storedReference = false;
+  fixedInterval = false;
+  reference = 0;
+  writtenReference = 0;
+  noise = 0;
+  threshold = 0x03;
+  wakeupMs = PN5180_LPCD_MAX_WAKEUP_MS;
+  setTargetLatency(targetLatencyMs);
+  configDirty = true;
+  resetStats();
+}
+
+/*
+ * Longest time a card may be in the field before the PN5180 wakes up.
+ * The wakeup interval never exceeds it.
+ */
+void PN5180LPCD::setTargetLatency(uint16_t targetLatencyMs) {
+  if (targetLatencyMs < PN5180_LPCD_MIN_WAKEUP_MS) targetLatencyMs = PN5180_LPCD_MIN_WAKEUP_MS;
+  if (targetLatencyMs > PN5180_LPCD_MAX_WAKEUP_MS) targetLatencyMs = PN5180_LPCD_MAX_WAKEUP_MS;
+  this->targetLatencyMs = targetLatencyMs;
+  if ((wakeupMs > targetLatencyMs) || fixedInterval) wakeupMs = targetLatencyMs;
+}
+
+/*
+ * Largest acceptable share of wakeups without a card, e.g. 0.1
+ */
+void PN5180LPCD::setMaxFalseWakeRate(float rate) {
+  maxFalseWakeRate = rate;
+}
+
+/*
+ * Field on time of each LPCD measurement, fieldOn x 8us + 62us
+ */
+void PN5180LPCD::setFieldOnTime(uint8_t fieldOn) {
+  this->fieldOn = fieldOn;
+  configDirty = true;
+}
+
+/*
+ * Compare against the calibrated reference (LPCD_MODE_STORED_REFERENCE)
+ * instead of letting the PN5180 measure a new reference when entering
+ * LPCD. The self calibration misses cards which are already in the field
+ * when entering LPCD.
+ */
+void PN5180LPCD::setStoredReference(bool enable) {
+  storedReference = enable;
+  configDirty = true;
+}
+
+/*
+ * Keep the wakeup interval at the target latency. Missed cards then only
+ * lower the threshold, the wakeup phase of the reader stays where it was
+ * placed, e.g. by PN5180LPCDCoordinator.
+ */
+void PN5180LPCD::setFixedInterval(bool enable) {
+  fixedInterval = enable;
+  if (enable) wakeupMs = targetLatencyMs;
+}
+
+/*
+ * Measure the AGC value samples times, reference is the mean and noise
+ * the largest deviation from it. Resets threshold and wakeup interval.
+ */
+bool PN5180LPCD::calibrate(uint8_t samples) {
+  if (samples == 0) samples = 1;
+  if (samples > PN5180_LPCD_MAX_SAMPLES) samples = PN5180_LPCD_MAX_SAMPLES;
+  uint16_t values[PN5180_LPCD_MAX_SAMPLES];
+  uint32_t sum = 0;
+  for (int i=0; i<samples; i++) {
+    if (!measureAGC(&values[i])) return false;
+    sum += values[i];
+  }
+  reference = sum / samples;
+  noise = 0;
+  for (int i=0; i<samples; i++) {
+    uint16_t deviation = (values[i] > reference) ? values[i] - reference : reference - values[i];
+    if (deviation > noise) noise = deviation;
+  }
+  uint16_t start = noise + PN5180_LPCD_THRESHOLD_MARGIN;
+  threshold = (start > 0xff) ? 0xff : start;
+  wakeupMs = targetLatencyMs;
+  windowWakeups = windowFalse = windowMissed = 0;
+  configDirty = true;
+
+  PN5180DEBUG(F("LPCD calibration: reference="));
+  PN5180DEBUG(reference);
+  PN5180DEBUG(F(", noise="));
+  PN5180DEBUG(noise);
+  PN5180DEBUG(F(", threshold="));
+  PN5180DEBUG(threshold);
+  PN5180DEBUG("\n");
+  return true;
+}
+
+/*
+ * Write changed settings to the EEPROM and switch the reader to LPCD
+ */
+bool PN5180LPCD::enter() {
+  if (configDirty) {
+    if (storedReference) {
+      uint8_t data[2] = { (uint8_t)(reference & 0xff), (uint8_t)(reference >> 8) };
+      if (!reader.writeEEprom(LPCD_REFERENCE_VALUE, data, 2)) return false;
+      writtenReference = reference;
+    }
+    uint8_t mode = storedReference ? LPCD_MODE_STORED_REFERENCE : LPCD_MODE_SELF_CALIBRATION;
+    if (!reader.prepareLPCD(fieldOn, threshold, mode)) return false;
+    configDirty = false;
+  }
+  return reader.switchToLPCD(wakeupMs);
+}
+
+/*
+ * Report the card poll after a LPCD wakeup, with the reader awake again.
+ * A wakeup without a card samples the AGC to track the environment.
+ */
+void PN5180LPCD::wakeup(bool cardFound) {
+  stats.wakeups++;
+  windowWakeups++;
+  if (cardFound) {
+    stats.cardWakeups++;
+  }
+  else {
+    stats.falseWakeups++;
+    windowFalse++;
+    uint16_t value;
+    if (measureAGC(&value)) track(value);
+  }
+  if (windowWakeups >= PN5180_LPCD_WINDOW) retune();
+}
+
+/*
+ * Report a card which was found without a LPCD wakeup, e.g. by a periodic
+ * poll. Retunes at once.
+ */
+void PN5180LPCD::missedCard() {
+  stats.missedCards++;
+  windowMissed++;
+  retune();
+}
+
+uint32_t PN5180LPCD::getFieldOnTimeUs() {
+  return (uint32_t)fieldOn * 8 + 62;
+}
+
+/*
+ * Share of time the RF field is on in LPCD
+ */
+float PN5180LPCD::getDutyCycle() {
+  return (float)getFieldOnTimeUs() / ((uint32_t)wakeupMs * 1000);
+}
+
+float PN5180LPCD::getFalseWakeRate() {
+  if (stats.wakeups == 0) return 0.0;
+  return (float)stats.falseWakeups / stats.wakeups;
+}
+
+void PN5180LPCD::resetStats() {
+  memset(&stats, 0, sizeof(stats));
+  windowWakeups = windowFalse = windowMissed = 0;
+}
+
+/*
+ * AGC value with the RF field on for the LPCD field on time
+ */
+bool PN5180LPCD::measureAGC(uint16_t *value) {
+  if (!reader.setRF_on()) return false;
+  delayMicroseconds(getFieldOnTimeUs());
+  uint32_t agc;
+  bool success = reader.readRegister(AGC_REF_CONFIG, &agc);
+  reader.setRF_off();
+  if (!success) return false;
+  *value = agc & AGC_VALUE_MASK;
+  return true;
+}
+
+/*
+ * Follow slow drifts: the reference moves by 1/4 of the deviation, the
+ * noise decays by 1/8 unless a larger deviation is seen
+ */
+void PN5180LPCD::track(uint16_t value) {
+  uint16_t deviation = (value > reference) ? value - reference : reference - value;
+  reference = (3 * (uint32_t)reference + value) / 4;
+  noise = (deviation > noise) ? deviation : noise - noise / 8;
+  if (threshold < minThreshold()) {
+    threshold = minThreshold();
+    configDirty = true;
+  }
+}
+
+uint8_t PN5180LPCD::minThreshold() {
+  return (noise >= 0xff) ? 0xff : noise + 1;
+}
+
+void PN5180LPCD::retune() {
+  uint8_t oldThreshold = threshold;
+  uint16_t oldWakeupMs = wakeupMs;
+  float falseRate = (windowWakeups > 0) ? (float)windowFalse / windowWakeups : 0.0;
+
+  if (windowMissed > 0) {
+    if (threshold > minThreshold()) threshold--;
+    else if (!fixedInterval && (wakeupMs / 2 >= PN5180_LPCD_MIN_WAKEUP_MS)) wakeupMs /= 2;
+  }
+  else if (falseRate > maxFalseWakeRate) {
+    if (threshold < 0xff) threshold++;
+  }
+  else if (wakeupMs < targetLatencyMs) {
+    wakeupMs = (2 * wakeupMs < targetLatencyMs) ? 2 * wakeupMs : targetLatencyMs;
+  }
+
+  if ((threshold != oldThreshold) || (wakeupMs != oldWakeupMs)) {
+    stats.retunes++;
+    PN5180DEBUG(F("LPCD retune: threshold="));
+    PN5180DEBUG(threshold);
+    PN5180DEBUG(F(", wakeup="));
+    PN5180DEBUG(wakeupMs);
+    PN5180DEBUG(F("ms\n"));
+  }
+  if (threshold != oldThreshold) configDirty = true;
+  // the drifted reference is written once per window, not per wakeup
+  if (storedReference && (reference != writtenReference)) configDirty = true;
+  windowWakeups = windowFalse = windowMissed = 0;
+}
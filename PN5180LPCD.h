@@ -0,0 +1,122 @@
+// NAME: PN5180LPCD.h
+//
+// DESC: Adaptive low power card detection (LPCD) for the PN5180 library.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+#ifndef PN5180LPCD_H
+#define PN5180LPCD_H
+
+#include <Arduino.h>
+#include "PN5180.h"
+
+// wakeups between two retunes of the threshold and wakeup interval
+#ifndef PN5180_LPCD_WINDOW
+#define PN5180_LPCD_WINDOW 16
+#endif
+#ifndef PN5180_LPCD_CALIBRATION_SAMPLES
+#define PN5180_LPCD_CALIBRATION_SAMPLES 8
+#endif
+#define PN5180_LPCD_MAX_SAMPLES 32
+// threshold above the measured AGC noise after calibration
+#ifndef PN5180_LPCD_THRESHOLD_MARGIN
+#define PN5180_LPCD_THRESHOLD_MARGIN 2
+#endif
+// wakeup counter range of SWITCH_MODE
+#define PN5180_LPCD_MIN_WAKEUP_MS 10
+#define PN5180_LPCD_MAX_WAKEUP_MS 2960
+
+struct LPCDStats {
+  uint32_t wakeups;
+  uint32_t cardWakeups;
+  uint32_t falseWakeups; // wakeup without a card
+  uint32_t missedCards;  // card found without a wakeup
+  uint16_t retunes;      // changes of threshold or wakeup interval
+};
+
+/*
+ * Adaptive LPCD controller for one reader.
+ * calibrate() measures the AGC value with the RF field on several times,
+ * the mean is the reference and the largest deviation is the noise. The
+ * threshold starts PN5180_LPCD_THRESHOLD_MARGIN above the noise and the
+ * wakeup interval at the target detection latency.
+ * The application reports the outcome of every wakeup with wakeup() and
+ * cards which were found without a wakeup with missedCard(). Every
+ * PN5180_LPCD_WINDOW wakeups the controller retunes:
+ *   missed cards:        lower the threshold, at the noise floor halve the
+ *                        wakeup interval (unless it is fixed)
+ *   too many false wakes: raise the threshold
+ *   otherwise:           double the wakeup interval up to the target
+ *                        latency, i.e. the lowest duty cycle
+ * False wakeups also sample the AGC, so reference and noise follow slow
+ * changes of the environment.
+ * The settings are stored in the PN5180 EEPROM, enter() only writes them
+ * after they changed.
+ */
+class PN5180LPCD {
+
+public:
+  PN5180LPCD(PN5180 &reader, uint16_t targetLatencyMs = 500);
+
+  void setTargetLatency(uint16_t targetLatencyMs);
+  void setMaxFalseWakeRate(float rate);
+  void setFieldOnTime(uint8_t fieldOn);
+  void setStoredReference(bool enable);
+  // wakeup interval always at the target latency, e.g. for staggered readers
+  void setFixedInterval(bool enable);
+
+  // with the reader awake and the RF field off
+  bool calibrate(uint8_t samples = PN5180_LPCD_CALIBRATION_SAMPLES);
+  bool enter();
+  // outcome of the card poll after a LPCD wakeup
+  void wakeup(bool cardFound);
+  void missedCard();
+
+  uint16_t getReference() { return reference; }
+  uint16_t getNoise() { return noise; }
+  uint8_t getThreshold() { return threshold; }
+  uint16_t getWakeupInterval() { return wakeupMs; }
+  uint32_t getFieldOnTimeUs();
+  float getDutyCycle();
+  float getFalseWakeRate();
+  const LPCDStats &getStats() { return stats; }
+  void resetStats();
+  PN5180 &getReader() { return reader; }
+
+private:
+  PN5180 &reader;
+  uint16_t targetLatencyMs;
+  float maxFalseWakeRate;
+  uint8_t fieldOn;
+  bool storedReference;
+  bool fixedInterval;
+
+  uint16_t reference;
+  uint16_t writtenReference;
+  uint16_t noise;
+  uint8_t threshold;
+  uint16_t wakeupMs;
+  bool configDirty;
+
+  uint8_t windowWakeups;
+  uint8_t windowFalse;
+  uint8_t windowMissed;
+  LPCDStats stats;
+
+  bool measureAGC(uint16_t *value);
+  void track(uint16_t value);
+  uint8_t minThreshold();
+  void retune();
+};
+
+#endif /* PN5180LPCD_H */
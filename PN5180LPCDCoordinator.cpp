@@ -0,0 +1,200 @@
+// NAME: PN5180LPCDCoordinator.cpp
+//
+// DESC: Staggered low power card detection of several PN5180 readers.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// #define DEBUG 1
+
+#include <Arduino.h>
+#include "PN5180LPCDCoordinator.h"
+#include "Debug.h"
+
+PN5180LPCDCoordinator::PN5180LPCDCoordinator(uint16_t periodMs) {
+  count = 0;
+  crossTalkMs = 20;
+  startedAt = 0;
+  lastServiced = 0;
+  setPeriod(periodMs);
+}
+
+/*
+ * Add the LPCD controller of a reader, irqPin is read by update() to
+ * detect its wakeup. The period becomes the fixed wakeup interval of the
+ * controller.
+ * Returns the index of the reader or -1 if PN5180_LPCD_MAX_READERS are
+ * already added.
+ */
+int8_t PN5180LPCDCoordinator::addReader(PN5180LPCD &controller, uint8_t irqPin) {
+  if (count >= PN5180_LPCD_MAX_READERS) return -1;
+  Reader *r = &readers[count];
+  memset(r, 0, sizeof(Reader));
+  r->controller = &controller;
+  controller.setTargetLatency(periodMs);
+  controller.setFixedInterval(true);
+  r->irqPin = irqPin;
+  r->state = LPCD_READER_IDLE;
+  if (irqPin != PN5180_LPCD_NO_IRQ) pinMode(irqPin, INPUT);
+  return count++;
+}
+
+/*
+ * Wakeup period of all readers, 10-2960ms (wakeup counter of SWITCH_MODE),
+ * and wakeup interval of their controllers.
+ * Takes effect when the readers enter LPCD the next time.
+ */
+void PN5180LPCDCoordinator::setPeriod(uint16_t periodMs) {
+  if (periodMs < PN5180_LPCD_MIN_WAKEUP_MS) periodMs = PN5180_LPCD_MIN_WAKEUP_MS;
+  if (periodMs > PN5180_LPCD_MAX_WAKEUP_MS) periodMs = PN5180_LPCD_MAX_WAKEUP_MS;
+  this->periodMs = periodMs;
+  for (int i=0; i<count; i++) {
+    readers[i].controller->setTargetLatency(periodMs);
+  }
+}
+
+/*
+ * A false wakeup within windowMs after another reader was serviced is
+ * counted as cross talk
+ */
+void PN5180LPCDCoordinator::setCrossTalkWindow(uint16_t windowMs) {
+  crossTalkMs = windowMs;
+}
+
+/*
+ * Schedule all readers into their phase slots, starting now
+ */
+void PN5180LPCDCoordinator::begin() {
+  startedAt = millis();
+  for (int i=0; i<count; i++) {
+    readers[i].state = LPCD_READER_SCHEDULED;
+    readers[i].enterAt = startedAt + getPhaseOffset(i);
+  }
+}
+
+void PN5180LPCDCoordinator::update() {
+  unsigned long now = millis();
+  for (int i=0; i<count; i++) {
+    Reader *r = &readers[i];
+    switch (r->state) {
+      case LPCD_READER_SCHEDULED:
+        if ((long)(now - r->enterAt) >= 0) {
+          if (r->controller->enter()) {
+            r->state = LPCD_READER_SLEEPING;
+          }
+          else {
+            PN5180DEBUG(F("LPCD coordinator: reader "));
+            PN5180DEBUG(i);
+            PN5180DEBUG(F(" failed to enter LPCD\n"));
+            r->enterAt = nextSlot(i, now + 1);
+          }
+        }
+        break;
+      case LPCD_READER_SLEEPING:
+        if ((r->irqPin != PN5180_LPCD_NO_IRQ) && digitalRead(r->irqPin)) {
+          notifyWake(i);
+        }
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+void PN5180LPCDCoordinator::notifyWake(uint8_t index) {
+  if ((index >= count) || (readers[index].state != LPCD_READER_SLEEPING)) return;
+  readers[index].state = LPCD_READER_WOKEN;
+  readers[index].wokeAt = millis();
+}
+
+/*
+ * Arbitration of the woken readers: one at a time, round robin starting
+ * after the last serviced reader, so a busy reader cannot starve the
+ * others. The returned reader is marked as being serviced.
+ */
+int8_t PN5180LPCDCoordinator::nextWake() {
+  for (int i=0; i<count; i++) {
+    if (readers[i].state == LPCD_READER_SERVICING) return -1;
+  }
+  for (int n=1; n<=count; n++) {
+    uint8_t i = (lastServiced + n) % count;
+    Reader *r = &readers[i];
+    if (r->state == LPCD_READER_WOKEN) {
+      uint32_t waitMs = millis() - r->wokeAt;
+      if (waitMs > r->stats.maxWaitMs) r->stats.maxWaitMs = waitMs;
+      r->state = LPCD_READER_SERVICING;
+      lastServiced = i;
+      return i;
+    }
+  }
+  return -1;
+}
+
+/*
+ * The application has handled the wakeup of reader index, with the reader
+ * still awake. The outcome retunes its controller, then it re-enters LPCD
+ * at its next slot.
+ */
+void PN5180LPCDCoordinator::serviced(uint8_t index, bool cardFound) {
+  if ((index >= count) || (readers[index].state != LPCD_READER_SERVICING)) return;
+  Reader *r = &readers[index];
+  r->controller->wakeup(cardFound);
+  unsigned long now = millis();
+  r->stats.wakeups++;
+  if (cardFound) {
+    r->stats.cardWakeups++;
+  }
+  else {
+    r->stats.falseWakeups++;
+    if (otherActive(index, r->wokeAt)) r->stats.crossTalkWakeups++;
+  }
+  r->activeUntil = now;
+  r->state = LPCD_READER_SCHEDULED;
+  r->enterAt = nextSlot(index, now);
+}
+
+uint16_t PN5180LPCDCoordinator::getPhaseOffset(uint8_t index) {
+  if (count == 0) return 0;
+  return (uint32_t)periodMs * index / count;
+}
+
+void PN5180LPCDCoordinator::resetStats() {
+  for (int i=0; i<count; i++) {
+    memset(&readers[i].stats, 0, sizeof(LPCDReaderStats));
+  }
+}
+
+/*
+ * First slot of reader index at or after now
+ */
+unsigned long PN5180LPCDCoordinator::nextSlot(uint8_t index, unsigned long now) {
+  unsigned long first = startedAt + getPhaseOffset(index);
+  if ((long)(now - first) <= 0) return first;
+  unsigned long periods = (now - first + periodMs - 1) / periodMs;
+  return first + periods * periodMs;
+}
+
+/*
+ * Was another reader serviced, i.e. had its field on, when reader index
+ * woke up at at, or shortly before?
+ */
+bool PN5180LPCDCoordinator::otherActive(uint8_t index, unsigned long at) {
+  for (int i=0; i<count; i++) {
+    Reader *r = &readers[i];
+    if ((i == index) || (r->activeUntil == 0)) continue;
+    // last service of reader i: wokeAt .. activeUntil
+    if (((long)(r->wokeAt - at) <= 0) && ((long)(at - r->activeUntil) <= (long)crossTalkMs)) {
+      return true;
+    }
+  }
+  return false;
+}
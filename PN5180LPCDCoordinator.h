@@ -0,0 +1,107 @@
+// NAME: PN5180LPCDCoordinator.h
+//
+// DESC: Staggered low power card detection of several PN5180 readers.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+#ifndef PN5180LPCDCOORDINATOR_H
+#define PN5180LPCDCOORDINATOR_H
+
+#include <Arduino.h>
+#include "PN5180LPCD.h"
+
+#ifndef PN5180_LPCD_MAX_READERS
+#define PN5180_LPCD_MAX_READERS 8
+#endif
+// reader without an IRQ pin, wakeups are reported with notifyWake()
+#define PN5180_LPCD_NO_IRQ 0xFF
+
+enum LPCDReaderState {
+  LPCD_READER_IDLE,      // not started
+  LPCD_READER_SCHEDULED, // waiting for its phase slot to enter LPCD
+  LPCD_READER_SLEEPING,  // in LPCD
+  LPCD_READER_WOKEN,     // LPCD wakeup, waiting to be serviced
+  LPCD_READER_SERVICING  // handled by the application
+};
+
+struct LPCDReaderStats {
+  uint32_t wakeups;
+  uint32_t cardWakeups;
+  uint32_t falseWakeups;     // wakeup without a card
+  uint32_t crossTalkWakeups; // false wakeups while another reader was active
+  uint32_t maxWaitMs;        // longest time between wakeup and service
+};
+
+/*
+ * Runs the LPCD controllers of several readers with the same wakeup period
+ * and evenly spaced phases, so their fields are never on at the same time.
+ * The period is the fixed wakeup interval of every controller, missed
+ * cards only lower their thresholds, so no reader leaves its slot.
+ * Reader i enters LPCD at t0 + i * period / n + k * period through
+ * PN5180LPCD::enter(). After a wakeup the reader re-enters LPCD at its next
+ * slot, which also removes the drift of its low power oscillator.
+ * Only one reader is serviced at a time: nextWake() hands out the woken
+ * readers round robin, the application handles it (reset(), card poll)
+ * and reports the outcome with serviced(), which is passed on to
+ * PN5180LPCD::wakeup() to retune the controller.
+ * A false wakeup shortly after another reader had its field on is counted
+ * as cross talk.
+ */
+class PN5180LPCDCoordinator {
+
+public:
+  PN5180LPCDCoordinator(uint16_t periodMs = 500);
+
+  int8_t addReader(PN5180LPCD &controller, uint8_t irqPin = PN5180_LPCD_NO_IRQ);
+  void setPeriod(uint16_t periodMs);
+  void setCrossTalkWindow(uint16_t windowMs);
+
+  void begin();
+  // enter readers whose slot has come and poll the IRQ pins, call from loop()
+  void update();
+  // LPCD wakeup of a reader without IRQ pin, call from loop() not from an ISR
+  void notifyWake(uint8_t index);
+  // reader to be serviced next, -1 if none or another one is serviced
+  int8_t nextWake();
+  void serviced(uint8_t index, bool cardFound);
+
+  uint8_t getReaderCount() { return count; }
+  PN5180LPCD &getController(uint8_t index) { return *readers[index].controller; }
+  PN5180 &getReader(uint8_t index) { return readers[index].controller->getReader(); }
+  LPCDReaderState getState(uint8_t index) { return readers[index].state; }
+  uint16_t getPhaseOffset(uint8_t index);
+  const LPCDReaderStats &getStats(uint8_t index) { return readers[index].stats; }
+  void resetStats();
+
+private:
+  struct Reader {
+    PN5180LPCD *controller;
+    uint8_t irqPin;
+    LPCDReaderState state;
+    unsigned long enterAt;      // millis() of the next slot
+    unsigned long wokeAt;
+    unsigned long activeUntil;  // end of the last service
+    LPCDReaderStats stats;
+  };
+  Reader readers[PN5180_LPCD_MAX_READERS];
+  uint8_t count;
+  uint16_t periodMs;
+  uint16_t crossTalkMs;
+  unsigned long startedAt;
+  uint8_t lastServiced;
+
+  unsigned long nextSlot(uint8_t index, unsigned long now);
+  bool otherActive(uint8_t index, unsigned long at);
+};
+
+#endif /* PN5180LPCDCOORDINATOR_H */
@@ -0,0 +1,226 @@
+// NAME: PN5180NDEF.cpp
+//
+// DESC: Streaming NDEF/TLV parser for NFC Forum Type 2 and Type 5 tags.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// #define DEBUG 1
+
+#include <Arduino.h>
+#include "PN5180NDEF.h"
+#include "Debug.h"
+
+// TLV types
+#define TLV_NULL        (0x00)
+#define TLV_NDEF        (0x03)
+#define TLV_TERMINATOR  (0xFE)
+
+void PN5180NDEF::begin(uint8_t *_buffer, uint16_t _bufferSize) {
+  buffer = _buffer;
+  bufferSize = _bufferSize;
+  filled = 0;
+  pos = 0;
+  messageStart = 0;
+  messageLength = 0;
+  recordPos = 0;
+  step = STEP_CC;
+  state = NDEF_NEED_MORE;
+}
+
+/*
+ * Capability container (CC):
+ *   Magic number E1 (E2 for Type 5 with 2 byte addressing), version/access,
+ *   memory size / 8, features/access.
+ *   Type 5 tags with more than 2040 bytes have an 8 byte CC with byte 2 = 0.
+ *
+ * TLV blocks:
+ *   T (1 byte), L (1 byte, or FF + 2 bytes), V (L bytes)
+ *   NULL and terminator TLVs have neither L nor V.
+ */
+NDEFParseState PN5180NDEF::feed(uint16_t len) {
+  if (state != NDEF_NEED_MORE) return state;
+  filled += len;
+  if (filled > bufferSize) {
+    state = NDEF_ERROR;
+    return state;
+  }
+
+  uint8_t tlvType;
+  uint16_t valueLength;
+  while (state == NDEF_NEED_MORE) {
+    switch (step) {
+      case STEP_CC:
+        if (filled < 4) return state;
+        if ((buffer[0] != 0xE1) && (buffer[0] != 0xE2)) {
+          PN5180DEBUG(F("NDEF: no capability container\n"));
+          state = NDEF_ERROR;
+          break;
+        }
+        pos = (buffer[2] == 0) ? 8 : 4;
+        step = STEP_TLV;
+        break;
+
+      case STEP_TLV:
+        if (filled < pos + 1) return state;
+        if (buffer[pos] == TLV_NULL) {
+          pos++;
+          break;
+        }
+        if (buffer[pos] == TLV_TERMINATOR) {
+          state = NDEF_NOT_FOUND;
+          break;
+        }
+        if (filled < pos + 2) return state;
+        tlvType = buffer[pos];
+        if (buffer[pos+1] == 0xFF) {
+          if (filled < pos + 4) return state;
+          valueLength = ((uint16_t)buffer[pos+2] << 8) | buffer[pos+3];
+          pos += 4;
+        }
+        else {
+          valueLength = buffer[pos+1];
+          pos += 2;
+        }
+        // the value of the TLV is tracked as message, skipped if not NDEF
+        messageStart = pos;
+        messageLength = valueLength;
+        step = (tlvType == TLV_NDEF) ? STEP_MESSAGE : STEP_SKIP;
+        break;
+
+      case STEP_SKIP:
+        // lock control, memory control and proprietary TLVs are skipped
+        if (filled < messageStart + messageLength) return state;
+        pos = messageStart + messageLength;
+        messageStart = 0;
+        messageLength = 0;
+        step = STEP_TLV;
+        break;
+
+      case STEP_MESSAGE:
+        if ((uint32_t)messageStart + messageLength > bufferSize) {
+          PN5180DEBUG(F("NDEF: buffer too small\n"));
+          state = NDEF_ERROR;
+          break;
+        }
+        if (filled < messageStart + messageLength) return state;
+        step = STEP_DONE;
+        state = NDEF_COMPLETE;
+        break;
+
+      case STEP_DONE:
+        break;
+    }
+  }
+  return state;
+}
+
+/*
+ * Number of bytes which are at least needed to make progress,
+ * the complete rest of the message once the NDEF TLV is known.
+ */
+uint16_t PN5180NDEF::bytesNeeded() {
+  if (state != NDEF_NEED_MORE) return 0;
+  uint16_t end;
+  switch (step) {
+    case STEP_CC: end = 4; break;
+    case STEP_TLV: end = pos + 4; break;
+    default: end = messageStart + messageLength; break;
+  }
+  return (end > filled) ? (end - filled) : 1;
+}
+
+/*
+ * Read a Type 2 tag with READ (16 bytes = 4 pages) from page 3 on,
+ * until the NDEF message is complete.
+ */
+NDEFParseState PN5180NDEF::readType2(PN5180ISO14443 &reader) {
+  uint8_t page = 3;
+  while (state == NDEF_NEED_MORE) {
+    if (bytesFree() < 16) {
+      state = NDEF_ERROR;
+      break;
+    }
+    if (!reader.mifareBlockRead(page, writePtr())) {
+      state = NDEF_ERROR;
+      break;
+    }
+    page += 4;
+    feed(16);
+  }
+  return state;
+}
+
+/*
+ * Read a Type 5 tag block by block from block 0 on, until the NDEF
+ * message is complete. Blocks above 255 are read with the extended
+ * commands, the message is only bounded by the buffer.
+ */
+NDEFParseState PN5180NDEF::readType5(PN5180ISO15693 &reader, uint8_t *uid, uint8_t blockSize) {
+  uint16_t blockNo = 0;
+  while (state == NDEF_NEED_MORE) {
+    if (bytesFree() < blockSize) {
+      state = NDEF_ERROR;
+      break;
+    }
+    if (ISO15693_EC_OK != reader.readSingleBlock(uid, blockNo, writePtr(), blockSize)) {
+      state = NDEF_ERROR;
+      break;
+    }
+    blockNo++;
+    feed(blockSize);
+  }
+  return state;
+}
+
+/*
+ * NDEF record:
+ *   Header: MB, ME, CF, SR, IL, TNF (3 bits)
+ *   Type length, Payload length (1 byte if SR, else 4 bytes), ID length (if IL)
+ *   Type, ID, Payload
+ * Returns the next record of the message, false after the last record.
+ */
+bool PN5180NDEF::nextRecord(NDEFRecord *record) {
+  if ((state != NDEF_COMPLETE) || (recordPos >= messageLength)) return false;
+  const uint8_t *p = buffer + messageStart + recordPos;
+  const uint8_t *end = buffer + messageStart + messageLength;
+
+  if (p + 2 > end) return false;
+  record->header = *p++;
+  record->tnf = record->header & 0x07;
+  record->typeLength = *p++;
+  if (record->header & 0x10) { // SR
+    if (p + 1 > end) return false;
+    record->payloadLength = *p++;
+  }
+  else {
+    if (p + 4 > end) return false;
+    record->payloadLength = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+    p += 4;
+  }
+  record->idLength = 0;
+  if (record->header & 0x08) { // IL
+    if (p + 1 > end) return false;
+    record->idLength = *p++;
+  }
+  if ((uint32_t)(end - p) < (uint32_t)record->typeLength + record->idLength + record->payloadLength) return false;
+  record->type = p;
+  p += record->typeLength;
+  record->id = p;
+  p += record->idLength;
+  record->payload = p;
+  p += record->payloadLength;
+
+  recordPos = p - (buffer + messageStart);
+  if (record->header & 0x40) recordPos = messageLength; // ME
+  return true;
+}
@@ -0,0 +1,83 @@
+// NAME: PN5180NDEF.h
+//
+// DESC: Streaming NDEF/TLV parser for NFC Forum Type 2 and Type 5 tags.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+#ifndef PN5180NDEF_H
+#define PN5180NDEF_H
+
+#include "PN5180ISO14443.h"
+#include "PN5180ISO15693.h"
+
+enum NDEFParseState {
+  NDEF_NEED_MORE,   // more tag memory is needed
+  NDEF_COMPLETE,    // NDEF message is complete
+  NDEF_NOT_FOUND,   // terminator TLV reached without NDEF message
+  NDEF_ERROR        // invalid capability container/TLV or buffer too small
+};
+
+// NDEF record, all pointers are views into the receive buffer
+struct NDEFRecord {
+  uint8_t header;   // MB, ME, CF, SR, IL flags and TNF
+  uint8_t tnf;
+  const uint8_t *type;
+  uint8_t typeLength;
+  const uint8_t *id;
+  uint8_t idLength;
+  const uint8_t *payload;
+  uint32_t payloadLength;
+};
+
+/*
+ * The tag memory is read into the caller's buffer, starting with the
+ * capability container, and parsed while it arrives. Reading stops as
+ * soon as the NDEF message TLV is complete.
+ */
+class PN5180NDEF {
+
+public:
+  void begin(uint8_t *buffer, uint16_t bufferSize);
+  NDEFParseState feed(uint16_t len);
+  NDEFParseState getState() { return state; }
+
+  // where and how much data to read next
+  uint8_t *writePtr() { return buffer + filled; }
+  uint16_t bytesFree() { return bufferSize - filled; }
+  uint16_t bytesNeeded();
+
+  // NFC Forum Type 2 tag (page 3 is the CC), read with READ (16 bytes)
+  NDEFParseState readType2(PN5180ISO14443 &reader);
+  // NFC Forum Type 5 tag (block 0 is the CC)
+  NDEFParseState readType5(PN5180ISO15693 &reader, uint8_t *uid, uint8_t blockSize);
+
+  // NDEF message, valid after NDEF_COMPLETE
+  const uint8_t *getMessage() { return buffer + messageStart; }
+  uint16_t getMessageLength() { return messageLength; }
+  bool nextRecord(NDEFRecord *record);
+  void rewindRecords() { recordPos = 0; }
+
+private:
+  enum ParserStep { STEP_CC, STEP_TLV, STEP_SKIP, STEP_MESSAGE, STEP_DONE };
+  uint8_t *buffer = 0L;
+  uint16_t bufferSize = 0;
+  uint16_t filled = 0;
+  uint16_t pos = 0;
+  uint16_t messageStart = 0;
+  uint16_t messageLength = 0;
+  uint16_t recordPos = 0;
+  ParserStep step = STEP_CC;
+  NDEFParseState state = NDEF_NEED_MORE;
+};
+
+#endif /* PN5180NDEF_H */
@@ -0,0 +1,199 @@
+// NAME: PN5180PresenceTracker.cpp
+//
+// DESC: Debounced card presence tracking for the PN5180 library.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// #define DEBUG 1
+
+#include <Arduino.h>
+#include "PN5180PresenceTracker.h"
+#include "Debug.h"
+
+PN5180PresenceTracker::PN5180PresenceTracker(uint8_t departMisses, uint8_t arriveHits,
+                                             uint16_t fastMs, uint16_t slowMs) {
+  setHysteresis(departMisses, arriveHits);
+  setPollInterval(fastMs, slowMs);
+  reset();
+}
+
+void PN5180PresenceTracker::setHysteresis(uint8_t departMisses, uint8_t arriveHits) {
+  this->departMisses = (departMisses > 0) ? departMisses : 1;
+  this->arriveHits = (arriveHits > 0) ? arriveHits : 1;
+}
+
+void PN5180PresenceTracker::setPollInterval(uint16_t fastMs, uint16_t slowMs) {
+  this->fastMs = fastMs;
+  this->slowMs = slowMs;
+}
+
+/*
+ * Forget the tracked card and all queued events
+ */
+void PN5180PresenceTracker::reset() {
+  state = PRESENCE_EMPTY;
+  uidLength = 0;
+  hits = 0;
+  misses = 0;
+  arrivedAt = 0;
+  departedAt = 0;
+  lastSeen = 0;
+  lastPoll = 0;
+  polled = false;
+  head = 0;
+  count = 0;
+  dropped = 0;
+  memset(uid, 0, sizeof(uid));
+}
+
+/*
+ * Feed the result of one poll into the tracker.
+ * cardUid : UID of the card seen in this poll, cardUidLength=0 if no card was seen
+ */
+void PN5180PresenceTracker::poll(const uint8_t *cardUid, uint8_t cardUidLength) {
+  unsigned long now = millis();
+  lastPoll = now;
+  polled = true;
+  if (cardUidLength > sizeof(uid)) cardUidLength = 0;
+
+  if (cardUidLength == 0) {
+    switch (state) {
+      case PRESENCE_ARRIVING:
+        // not confirmed, forget it without an event
+        state = PRESENCE_EMPTY;
+        hits = 0;
+        break;
+      case PRESENCE_PRESENT:
+      case PRESENCE_LEAVING:
+        state = PRESENCE_LEAVING;
+        if (++misses >= departMisses) {
+          depart(now);
+        }
+        break;
+      default:
+        break;
+    }
+    return;
+  }
+
+  if ((state != PRESENCE_EMPTY) && !sameUID(cardUid, cardUidLength)) {
+    // another card replaced the tracked one
+    if (isPresent()) depart(now);
+    state = PRESENCE_EMPTY;
+  }
+  misses = 0;
+  lastSeen = now;
+  switch (state) {
+    case PRESENCE_EMPTY:
+      memset(uid, 0, sizeof(uid));
+      memcpy(uid, cardUid, cardUidLength);
+      uidLength = cardUidLength;
+      arrivedAt = now;
+      hits = 0;
+      state = PRESENCE_ARRIVING;
+      // fall through
+    case PRESENCE_ARRIVING:
+      if (++hits >= arriveHits) {
+        state = PRESENCE_PRESENT;
+        pushEvent(PRESENCE_ARRIVED, arrivedAt, 0);
+      }
+      break;
+    case PRESENCE_LEAVING:
+      PN5180DEBUG(F("Presence: card back after miss\n"));
+      state = PRESENCE_PRESENT;
+      break;
+    default:
+      break;
+  }
+}
+
+/*
+ * Poll the reader if the poll interval has expired.
+ * Reader errors are not counted as a miss, the card state is unknown.
+ * Returns true if the reader was polled.
+ */
+bool PN5180PresenceTracker::update(PN5180ISO14443 &reader) {
+  if (!pollDue()) return false;
+  if (ISO14443_ERROR == reader.update()) {
+    lastPoll = millis();
+    polled = true;
+    return true;
+  }
+  poll(reader.getTagData(), reader.getTagLength());
+  return true;
+}
+
+uint16_t PN5180PresenceTracker::getPollInterval() {
+  if ((state == PRESENCE_ARRIVING) || (state == PRESENCE_LEAVING)) {
+    return fastMs;
+  }
+  return slowMs;
+}
+
+bool PN5180PresenceTracker::pollDue() {
+  return !polled || (millis() - lastPoll >= getPollInterval());
+}
+
+/*
+ * Time the current card is present, or the dwell time of the last card
+ * if no card is present
+ */
+unsigned long PN5180PresenceTracker::getDwellTime() {
+  if (isPresent()) return millis() - arrivedAt;
+  if (departedAt == 0) return 0;
+  return departedAt - arrivedAt;
+}
+
+/*
+ * Fetch the oldest queued event.
+ * Returns false if the queue is empty.
+ */
+bool PN5180PresenceTracker::getEvent(PresenceEvent *event) {
+  if (count == 0) return false;
+  *event = queue[head];
+  head = (head + 1) % PN5180_PRESENCE_QUEUE_SIZE;
+  count--;
+  return true;
+}
+
+bool PN5180PresenceTracker::sameUID(const uint8_t *other, uint8_t otherLength) {
+  return (otherLength == uidLength) && (0 == memcmp(other, uid, uidLength));
+}
+
+void PN5180PresenceTracker::pushEvent(PresenceEventType type, unsigned long timestamp, unsigned long dwellMs) {
+  if (count == PN5180_PRESENCE_QUEUE_SIZE) {
+    // queue full, drop the oldest event
+    head = (head + 1) % PN5180_PRESENCE_QUEUE_SIZE;
+    count--;
+    dropped++;
+  }
+  PresenceEvent *event = &queue[(head + count) % PN5180_PRESENCE_QUEUE_SIZE];
+  event->type = type;
+  memcpy(event->uid, uid, sizeof(uid));
+  event->uidLength = uidLength;
+  event->timestamp = timestamp;
+  event->dwellMs = dwellMs;
+  count++;
+}
+
+/*
+ * The departure is dated to the last poll which saw the card, the misses
+ * only confirm it. A replaced card departs when the new one is seen.
+ */
+void PN5180PresenceTracker::depart(unsigned long now) {
+  departedAt = (misses > 0) ? lastSeen : now;
+  pushEvent(PRESENCE_DEPARTED, departedAt, departedAt - arrivedAt);
+  state = PRESENCE_EMPTY;
+  hits = 0;
+  misses = 0;
+}
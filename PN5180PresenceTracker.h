@@ -0,0 +1,115 @@
+// NAME: PN5180PresenceTracker.h
+//
+// DESC: Debounced card presence tracking for the PN5180 library.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+#ifndef PN5180PRESENCETRACKER_H
+#define PN5180PRESENCETRACKER_H
+
+#include <Arduino.h>
+#include "PN5180ISO14443.h"
+
+#ifndef PN5180_PRESENCE_QUEUE_SIZE
+#define PN5180_PRESENCE_QUEUE_SIZE 8
+#endif
+
+enum PresenceState {
+  PRESENCE_EMPTY,
+  PRESENCE_ARRIVING, // card seen, not yet confirmed
+  PRESENCE_PRESENT,
+  PRESENCE_LEAVING   // card missed, not yet departed
+};
+
+enum PresenceEventType {
+  PRESENCE_ARRIVED,
+  PRESENCE_DEPARTED
+};
+
+struct PresenceEvent {
+  PresenceEventType type;
+  uint8_t uid[10];
+  uint8_t uidLength;
+  unsigned long timestamp; // millis() of the arrival or departure
+  unsigned long dwellMs;   // time the card was present, departures only
+};
+
+/*
+ * Debounced card presence with hysteresis.
+ * A card has arrived after arriveHits consecutive polls saw its UID and
+ * has departed after departMisses consecutive polls missed it, so a
+ * single missed poll does not produce a remove/insert pair. A different
+ * UID departs the old card immediately.
+ * Events are queued in a fixed-size ring, the oldest event is dropped if
+ * the application does not fetch them in time.
+ * getPollInterval() is fastMs while a card is arriving or leaving and
+ * slowMs while the field is stable or empty.
+ */
+class PN5180PresenceTracker {
+
+public:
+  PN5180PresenceTracker(uint8_t departMisses = 3, uint8_t arriveHits = 1,
+                        uint16_t fastMs = 20, uint16_t slowMs = 200);
+
+  void setHysteresis(uint8_t departMisses, uint8_t arriveHits = 1);
+  void setPollInterval(uint16_t fastMs, uint16_t slowMs);
+  void reset();
+
+  // feed one poll result, cardUidLength=0 if no card was seen
+  void poll(const uint8_t *cardUid, uint8_t cardUidLength);
+  // poll the reader with update() if the poll interval has expired
+  bool update(PN5180ISO14443 &reader);
+
+  uint16_t getPollInterval();
+  bool pollDue();
+  PresenceState getState() { return state; }
+  bool isPresent() { return (state == PRESENCE_PRESENT) || (state == PRESENCE_LEAVING); }
+  const uint8_t *getUID() { return uid; }
+  uint8_t getUIDLength() { return isPresent() ? uidLength : 0; }
+  unsigned long getArrivalTime() { return arrivedAt; }
+  unsigned long getDepartureTime() { return departedAt; }
+  unsigned long getDwellTime();
+
+  // event queue
+  uint8_t available() { return count; }
+  bool getEvent(PresenceEvent *event);
+  uint16_t getDroppedEvents() { return dropped; }
+
+private:
+  uint8_t departMisses;
+  uint8_t arriveHits;
+  uint16_t fastMs;
+  uint16_t slowMs;
+
+  PresenceState state;
+  uint8_t uid[10];
+  uint8_t uidLength;
+  uint8_t hits;
+  uint8_t misses;
+  unsigned long arrivedAt;
+  unsigned long departedAt;
+  unsigned long lastSeen;
+  unsigned long lastPoll;
+  bool polled;
+
+  PresenceEvent queue[PN5180_PRESENCE_QUEUE_SIZE];
+  uint8_t head;
+  uint8_t count;
+  uint16_t dropped;
+
+  bool sameUID(const uint8_t *other, uint8_t otherLength);
+  void pushEvent(PresenceEventType type, unsigned long timestamp, unsigned long dwellMs);
+  void depart(unsigned long now);
+};
+
+#endif /* PN5180PRESENCETRACKER_H */
@@ -0,0 +1,123 @@
+// NAME: PN5180TagCache.cpp
+//
+// DESC: UID-keyed cache of tag memory blocks for the PN5180 library.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// #define DEBUG 1
+
+#include <Arduino.h>
+#include "PN5180TagCache.h"
+#include "Debug.h"
+
+PN5180TagCache::PN5180TagCache(uint32_t maxAgeMs) : maxAge(maxAgeMs) {
+  clear();
+}
+
+void PN5180TagCache::setMaxAge(uint32_t maxAgeMs) {
+  maxAge = maxAgeMs;
+}
+
+/*
+ * Copy a cached block to data.
+ * Returns false if the block is not cached, stale or has a different length.
+ */
+bool PN5180TagCache::lookup(const uint8_t *uid, uint8_t uidLength, uint16_t blockNo, uint8_t *data, uint8_t len) {
+  Entry *entry = find(uid, uidLength, blockNo);
+  if ((0L != entry) && (maxAge > 0) && (millis() - entry->storedAt > maxAge)) {
+    PN5180DEBUG(F("TagCache: stale block "));
+    PN5180DEBUG(blockNo);
+    PN5180DEBUG("\n");
+    entry->uidLength = 0;
+    entry = 0L;
+  }
+  if ((0L == entry) || (entry->len != len)) {
+    misses++;
+    return false;
+  }
+  memcpy(data, entry->data, len);
+  entry->lastUsed = ++tick;
+  hits++;
+  return true;
+}
+
+/*
+ * Store a block read from or written to the tag, replacing the least
+ * recently used entry if the cache is full.
+ */
+void PN5180TagCache::store(const uint8_t *uid, uint8_t uidLength, uint16_t blockNo, const uint8_t *data, uint8_t len) {
+  if ((len > PN5180_TAG_CACHE_BLOCK_SIZE) || (uidLength == 0) || (uidLength > 10)) return;
+
+  Entry *entry = find(uid, uidLength, blockNo);
+  if (0L == entry) {
+    entry = &entries[0];
+    for (int i=0; i<PN5180_TAG_CACHE_ENTRIES; i++) {
+      if (entries[i].uidLength == 0) {
+        entry = &entries[i];
+        break;
+      }
+      if ((uint16_t)(tick - entries[i].lastUsed) > (uint16_t)(tick - entry->lastUsed)) {
+        entry = &entries[i];
+      }
+    }
+  }
+  memcpy(entry->uid, uid, uidLength);
+  entry->uidLength = uidLength;
+  entry->blockNo = blockNo;
+  entry->len = len;
+  memcpy(entry->data, data, len);
+  entry->storedAt = millis();
+  entry->lastUsed = ++tick;
+}
+
+void PN5180TagCache::invalidate(const uint8_t *uid, uint8_t uidLength, uint16_t blockNo) {
+  Entry *entry = find(uid, uidLength, blockNo);
+  if (0L != entry) entry->uidLength = 0;
+}
+
+void PN5180TagCache::invalidate(const uint8_t *uid, uint8_t uidLength) {
+  for (int i=0; i<PN5180_TAG_CACHE_ENTRIES; i++) {
+    if ((entries[i].uidLength == uidLength) && (memcmp(entries[i].uid, uid, uidLength) == 0)) {
+      entries[i].uidLength = 0;
+    }
+  }
+}
+
+void PN5180TagCache::clear() {
+  for (int i=0; i<PN5180_TAG_CACHE_ENTRIES; i++) {
+    entries[i].uidLength = 0;
+  }
+  tick = 0;
+}
+
+float PN5180TagCache::hitRate() {
+  uint32_t lookups = hits + misses;
+  if (lookups == 0) return 0.0;
+  return (float)hits / lookups;
+}
+
+void PN5180TagCache::resetStats() {
+  hits = 0;
+  misses = 0;
+}
+
+PN5180TagCache::Entry *PN5180TagCache::find(const uint8_t *uid, uint8_t uidLength, uint16_t blockNo) {
+  for (int i=0; i<PN5180_TAG_CACHE_ENTRIES; i++) {
+    Entry *entry = &entries[i];
+    if ((entry->uidLength == uidLength) && (entry->blockNo == blockNo) &&
+        (memcmp(entry->uid, uid, uidLength) == 0)) {
+      return entry;
+    }
+  }
+  return 0L;
+}
@@ -0,0 +1,85 @@
+// NAME: PN5180TagCache.h
+//
+// DESC: UID-keyed cache of tag memory blocks for the PN5180 library.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+#ifndef PN5180TAGCACHE_H
+#define PN5180TAGCACHE_H
+
+#include <Arduino.h>
+
+#ifndef PN5180_TAG_CACHE_ENTRIES
+#define PN5180_TAG_CACHE_ENTRIES 16
+#endif
+// largest block which is cached, larger blocks are always read from the tag
+#ifndef PN5180_TAG_CACHE_BLOCK_SIZE
+#define PN5180_TAG_CACHE_BLOCK_SIZE 16
+#endif
+// default age after which a cached block is read from the tag again
+#ifndef PN5180_TAG_CACHE_MAX_AGE_MS
+#define PN5180_TAG_CACHE_MAX_AGE_MS 2000
+#endif
+
+/*
+ * Bounded LRU cache of tag memory blocks, keyed by UID and block number.
+ * Attach it to a reader with setTagCache(), reads are then answered from
+ * the cache if possible and writes through the reader invalidate the
+ * affected blocks.
+ * Entries older than maxAgeMs are stale and read from the tag again, so a
+ * tag which stays in the field is served from the cache across polls.
+ * The readers drop the entries of a tag when it no longer answers, since it
+ * may be written by another reader before it returns. maxAgeMs=0 keeps
+ * entries until then.
+ */
+class PN5180TagCache {
+
+public:
+  PN5180TagCache(uint32_t maxAgeMs = PN5180_TAG_CACHE_MAX_AGE_MS);
+
+  void setMaxAge(uint32_t maxAgeMs);
+  bool lookup(const uint8_t *uid, uint8_t uidLength, uint16_t blockNo, uint8_t *data, uint8_t len);
+  void store(const uint8_t *uid, uint8_t uidLength, uint16_t blockNo, const uint8_t *data, uint8_t len);
+  void invalidate(const uint8_t *uid, uint8_t uidLength, uint16_t blockNo);
+  void invalidate(const uint8_t *uid, uint8_t uidLength);
+  void clear();
+
+  /*
+   * Statistics
+   */
+public:
+  uint32_t getHits() { return hits; }
+  uint32_t getMisses() { return misses; }
+  float hitRate();
+  void resetStats();
+
+private:
+  struct Entry {
+    uint8_t uid[10];
+    uint8_t uidLength; // 0 = unused entry
+    uint8_t len;
+    uint16_t blockNo;
+    uint16_t lastUsed;
+    unsigned long storedAt;
+    uint8_t data[PN5180_TAG_CACHE_BLOCK_SIZE];
+  };
+  Entry entries[PN5180_TAG_CACHE_ENTRIES];
+  uint32_t maxAge;
+  uint16_t tick = 0;
+  uint32_t hits = 0;
+  uint32_t misses = 0;
+
+  Entry *find(const uint8_t *uid, uint8_t uidLength, uint16_t blockNo);
+};
+
+#endif /* PN5180TAGCACHE_H */